@@ -0,0 +1,746 @@
+/**
+ * bcm2-utils
+ * Copyright (C) 2016 Joseph Lehner <joseph.c.lehner@gmail.com>
+ *
+ * bcm2-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bcm2-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bcm2-utils.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <openssl/aes.h>
+#include <openssl/md5.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <random>
+#include "gwsettings.h"
+#include "interface.h"
+#include "nonvol2.h"
+#include "rwx.h"
+#include "ps.h"
+#include "io.h"
+using namespace bcm2cfg;
+using namespace bcm2dump;
+using namespace std;
+
+#ifndef VERSION
+#define VERSION "v(unknown)"
+#endif
+
+namespace {
+
+// minimum run time of each benchmark
+unsigned min_millis = 250;
+
+struct result
+{
+	string name;
+	uint64_t iterations;
+	double nanos_per_op;
+	// bytes processed per iteration; 0 if not applicable
+	uint64_t bytes;
+	string error;
+};
+
+vector<result> results;
+
+// prevent the compiler from optimizing away results
+volatile uint64_t sink;
+
+void run(const string& name, const string& filter, uint64_t bytes, const function<void()>& f)
+{
+	if (!filter.empty() && !contains(name, filter)) {
+		return;
+	}
+
+	result r = { name, 0, 0, bytes, "" };
+
+	try {
+		// warm up, and catch errors early
+		f();
+
+		auto start = chrono::steady_clock::now();
+		chrono::nanoseconds elapsed;
+
+		do {
+			f();
+			++r.iterations;
+			elapsed = chrono::steady_clock::now() - start;
+		} while (elapsed < chrono::milliseconds(min_millis));
+
+		r.nanos_per_op = double(elapsed.count()) / r.iterations;
+	} catch (const exception& e) {
+		r.error = e.what();
+	}
+
+	logger::v() << name << ": " << r.iterations << " iterations, " << r.nanos_per_op << " ns/op" << endl;
+	results.push_back(r);
+}
+
+string json_escape(const string& str)
+{
+	string ret;
+	for (char c : str) {
+		if (c == '"' || c == '\\') {
+			ret += '\\';
+			ret += c;
+		} else if (c < 0x20) {
+			ret += "\\u00" + to_hex(c);
+		} else {
+			ret += c;
+		}
+	}
+
+	return ret;
+}
+
+void print_json(ostream& os)
+{
+	os << "{" << endl;
+	os << "  \"version\": \"" << json_escape(VERSION) << "\"," << endl;
+	os << "  \"benchmarks\": [";
+
+	bool first = true;
+
+	for (auto r : results) {
+		os << (first ? "" : ",") << endl;
+		os << "    { \"name\": \"" << json_escape(r.name) << "\", \"iterations\": " << r.iterations
+				<< ", \"ns_per_op\": " << fixed << setprecision(1) << r.nanos_per_op;
+		if (r.bytes) {
+			double bps = r.nanos_per_op ? (r.bytes * 1e9 / r.nanos_per_op) : 0;
+			os << ", \"bytes\": " << r.bytes << ", \"bytes_per_sec\": " << setprecision(0) << bps;
+		}
+		if (!r.error.empty()) {
+			os << ", \"error\": \"" << json_escape(r.error) << "\"";
+		}
+		os << " }";
+		first = false;
+	}
+
+	os << endl << "  ]" << endl << "}" << endl;
+}
+
+string random_data(size_t size, unsigned seed)
+{
+	mt19937 rng(seed);
+	string ret(size, '\0');
+	for (char& c : ret) {
+		c = rng() & 0xff;
+	}
+
+	return ret;
+}
+
+template<class T> string to_buf(const T& t)
+{
+	return string(reinterpret_cast<const char*>(&t), sizeof(T));
+}
+
+string hex_word(const string& buf, size_t offset)
+{
+	return to_hex(ntohl(extract<uint32_t>(buf, offset)));
+}
+
+// simulates a bfc console or a bootloader menu, without any i/o
+// latency. this allows us to benchmark the host side of each rwx
+// implementation (i.e. command generation and line parsing).
+class simulator : public io
+{
+	public:
+	simulator(bool bootloader, size_t size)
+	: m_bootloader(bootloader), m_mem(random_data(size, 1)) {}
+
+	virtual int getc() override
+	{
+		if (m_pos >= m_out.size()) {
+			return eof;
+		}
+
+		return m_out[m_pos++] & 0xff;
+	}
+
+	virtual string read(size_t length, bool partial = true) override
+	{
+		string ret = m_out.substr(m_pos, length);
+		m_pos += ret.size();
+		if (!partial && ret.size() != length) {
+			throw runtime_error("short read");
+		}
+		return ret;
+	}
+
+	virtual void writeln(const string& str) override
+	{ handle_line(str); }
+
+	virtual void write(const string& str) override
+	{
+		if (str.size() >= 2 && str.substr(str.size() - 2) == "\r\n") {
+			handle_line(str.substr(0, str.size() - 2));
+		} else if (m_bootloader) {
+			for (char c : str) {
+				handle_key(c);
+			}
+		}
+	}
+
+	virtual bool pending(unsigned timeout) override
+	{ return m_pos < m_out.size(); }
+
+	const string& mem() const
+	{ return m_mem; }
+
+	// offsets are mapped into a memory area that is sized to a power of two
+	uint32_t map(uint32_t offset) const
+	{ return offset & (m_mem.size() - 1); }
+
+	private:
+	void emit(const string& str)
+	{
+		if (m_pos == m_out.size()) {
+			m_out.clear();
+			m_pos = 0;
+		}
+
+		m_out += str;
+	}
+
+	void handle_line(const string& line)
+	{
+		if (m_bootloader) {
+			handle_bootloader_line(line);
+		} else {
+			handle_bfc_line(line);
+		}
+	}
+
+	void handle_key(char c);
+	void handle_bootloader_line(const string& line);
+	void handle_bfc_line(const string& line);
+	void read_memory(uint32_t offset, uint32_t length);
+	void flash_read(uint32_t offset, uint32_t length);
+	void cfg_hex_show();
+
+	bool m_bootloader;
+	string m_mem;
+	string m_out;
+	size_t m_pos = 0;
+
+	enum { menu, reading, write_addr, write_val } m_state = menu;
+	uint32_t m_write_addr = 0;
+};
+
+void simulator::handle_key(char c)
+{
+	if (m_state != menu) {
+		return;
+	} else if (c == 'r') {
+		emit("r\r\n\r\nRead memory.\r\n");
+		m_state = reading;
+	} else if (c == 'w') {
+		emit("w\r\n\r\nWrite memory.\r\nHex address: ");
+		m_state = write_addr;
+	}
+}
+
+void simulator::handle_bootloader_line(const string& line)
+{
+	if (m_state == reading) {
+		if (line.empty()) {
+			m_state = menu;
+		} else {
+			uint32_t offset = lexical_cast<uint32_t>(line, 0);
+			emit("Value at " + to_hex(offset) + ": " + hex_word(m_mem, map(offset)) + " (hex)\r\n");
+			return;
+		}
+	} else if (m_state == write_addr) {
+		m_write_addr = lexical_cast<uint32_t>(line, 16);
+		emit(line + "\r\nHex value: ");
+		m_state = write_val;
+		return;
+	} else if (m_state == write_val) {
+		patch<uint32_t>(m_mem, map(m_write_addr), htonl(lexical_cast<uint32_t>(line, 16)));
+		emit(line + "\r\n");
+		m_state = menu;
+	}
+
+	emit("\r\nMain Menu:\r\n==========\r\n  r) Read memory\r\n  w) Write memory\r\n\r\n");
+}
+
+void simulator::handle_bfc_line(const string& line)
+{
+	auto tok = split(line, ' ', false);
+
+	if (tok.empty() || line == "cd /") {
+		// fall through to prompt
+	} else if (tok[0] == "/read_memory" && tok.size() == 6) {
+		read_memory(lexical_cast<uint32_t>(tok[5], 0), lexical_cast<uint32_t>(tok[4]));
+	} else if (tok[0] == "/write_memory" && tok.size() == 5) {
+		uint32_t offset = lexical_cast<uint32_t>(tok[3], 0);
+		patch<uint32_t>(m_mem, map(offset), htonl(lexical_cast<uint32_t>(tok[4], 0)));
+		emit("Writing " + tok[4] + " to " + tok[3] + "\r\n");
+	} else if (tok[0] == "/flash/open") {
+		emit("Flash driver opened\r\n");
+	} else if (tok[0] == "/flash/close") {
+		emit("Flash driver closed\r\n");
+	} else if (tok[0] == "/flash/read" && tok.size() == 4) {
+		flash_read(lexical_cast<uint32_t>(tok[3]), lexical_cast<uint32_t>(tok[2]));
+	} else if (tok[0] == "/flash/write" && tok.size() == 4) {
+		uint32_t offset = lexical_cast<uint32_t>(tok[2], 0);
+		patch<uint32_t>(m_mem, map(offset), htonl(lexical_cast<uint32_t>(tok[3], 0)));
+		emit("Value " + tok[3] + " successfully written\r\n");
+	} else if (tok[0] == "/docsis_ctl/cfg_hex_show") {
+		cfg_hex_show();
+	} else {
+		emit("ERROR: unknown command " + tok[0] + "\r\n");
+	}
+
+	emit("\r\nCM> ");
+}
+
+void simulator::read_memory(uint32_t offset, uint32_t length)
+{
+	for (uint32_t i = 0; i < length; i += 16) {
+		string line = to_hex(offset + i) + ": ";
+		for (unsigned k = 0; k < 16; k += 4) {
+			line += hex_word(m_mem, map(offset + i + k)) + "  ";
+		}
+		line.resize(48);
+		emit(line + " | ................\r\n");
+	}
+}
+
+void simulator::flash_read(uint32_t offset, uint32_t length)
+{
+	string line;
+
+	for (uint32_t i = 0; i < length; i += 4) {
+		line += hex_word(m_mem, map(offset + i)) + " ";
+		if ((i % 32) == 28 || (i + 4) >= length) {
+			emit(line + "\r\n");
+			line.clear();
+		}
+	}
+}
+
+void simulator::cfg_hex_show()
+{
+	// a config file, using the last bytes of memory. the odd size
+	// ensures that the last line is incomplete.
+	const uint32_t length = 1031;
+	const uint32_t offset = m_mem.size() - length;
+
+	for (uint32_t i = 0; i < length; i += 16) {
+		string line;
+		for (unsigned k = 0; k < 16; ++k) {
+			line += (i + k) < length ? to_hex(m_mem[offset + i + k]) : "  ";
+			line += ((k % 4) == 3) ? "   " : " ";
+		}
+		line.resize(53);
+		emit(line + "  | " + string(min(length - i, 16u), '.') + "\r\n");
+	}
+}
+
+struct sim_target
+{
+	shared_ptr<simulator> sim;
+	interface::sp intf;
+};
+
+sim_target make_target(bool bootloader, size_t size)
+{
+	sim_target ret;
+	ret.sim = make_shared<simulator>(bootloader, size);
+	ret.intf = interface::detect(ret.sim, profile::get("generic"));
+	return ret;
+}
+
+void bench_dump(const string& filter, const string& name, bool bootloader, const string& space, uint32_t offset, uint32_t length, const string& spec = "")
+{
+	auto t = make_target(bootloader, 1024 * 1024);
+	auto rwx = rwx::create(t.intf, space, true);
+
+	run("rwx/" + name + "/dump", filter, length, [&] () {
+		ostringstream ostr;
+		if (spec.empty()) {
+			rwx->dump(offset, length, ostr);
+		} else {
+			rwx->dump(spec, ostr);
+		}
+
+		if (ostr.str() != t.sim->mem().substr(t.sim->map(offset), length)) {
+			throw runtime_error("data mismatch");
+		}
+	});
+}
+
+void bench_write(const string& filter, const string& name, bool bootloader, const string& space, uint32_t offset, uint32_t length, bool stream = false)
+{
+	auto t = make_target(bootloader, 1024 * 1024);
+	auto rwx = rwx::create(t.intf, space, true);
+	string data = random_data(length, 2);
+
+	run("rwx/" + name + (stream ? "/write_stream" : "/write"), filter, length, [&] () {
+		if (stream) {
+			istringstream istr(data);
+			rwx->write(offset, istr, length);
+		} else {
+			rwx->write(offset, data);
+		}
+
+		if (t.sim->mem().substr(t.sim->map(offset), length) != data) {
+			throw runtime_error("data mismatch");
+		}
+	});
+}
+
+void bench_rwx(const string& filter)
+{
+	bench_dump(filter, "bfc_ram", false, "ram", 0x80000000, 256 * 1024);
+	bench_write(filter, "bfc_ram", false, "ram", 0x80000000, 4096);
+	bench_write(filter, "bfc_ram", false, "ram", 0x80000000, 64 * 1024, true);
+	bench_dump(filter, "bfc_flash", false, "flash", 0, 64 * 1024, "image1,64k");
+	bench_dump(filter, "bootloader_ram", true, "ram", 0x80000000, 16 * 1024);
+	bench_write(filter, "bootloader_ram", true, "ram", 0x80000000, 4096);
+
+	auto t = make_target(false, 1024 * 1024);
+	auto rwx = rwx::create_special(t.intf, "cmcfg");
+
+	run("rwx/bfc_cmcfg/dump", filter, 1031, [&] () {
+		ostringstream ostr;
+		rwx->dump(0, 0, ostr);
+		// the terminating 0xff byte is not displayed by cfg_hex_show
+		if (ostr.str() != t.sim->mem().substr(t.sim->mem().size() - 1031) + "\xff") {
+			throw runtime_error("data mismatch");
+		}
+	});
+}
+
+void bench_util(const string& filter)
+{
+	string buf = random_data(64 * 1024, 3);
+
+	run("util/crc16_ccitt", filter, buf.size(), [&] () {
+		sink = crc16_ccitt(buf);
+	});
+
+	run("util/crc32_ieee", filter, buf.size(), [&] () {
+		sink = crc32_ieee(buf);
+	});
+
+	run("util/lexical_cast/dec", filter, 0, [&] () {
+		sink = lexical_cast<uint32_t>("3735928559");
+	});
+
+	run("util/lexical_cast/hex", filter, 0, [&] () {
+		sink = lexical_cast<uint32_t>("deadbeef", 16);
+	});
+
+	run("util/to_hex/u32", filter, 0, [&] () {
+		sink = to_hex(uint32_t(0xdeadbeef)).size();
+	});
+
+	string line = buf.substr(0, 16);
+
+	run("util/to_hex/string", filter, line.size(), [&] () {
+		sink = to_hex(line).size();
+	});
+}
+
+void bench_ps(const string& filter)
+{
+	ps_header::raw raw;
+	memset(&raw, 0, sizeof(raw));
+	raw.signature = htons(0xa825);
+	raw.length = htonl(0x6c0000);
+	raw.loadaddr = htonl(0x80004000);
+	strncpy(raw.filename, "bench.bin", sizeof(raw.filename));
+	raw.hcs = htons(~crc16_ccitt(&raw, offsetof(ps_header::raw, hcs)));
+
+	string buf(reinterpret_cast<const char*>(&raw), sizeof(raw));
+	ps_header hdr(buf);
+
+	run("ps/ps_header::parse", filter, buf.size(), [&] () {
+		hdr.parse(buf);
+		sink = hdr.hcs_valid();
+	});
+
+	string data = random_data(1024 * 1024, 4);
+	data.replace(0x1000, buf.size(), buf);
+
+	run("ps/ps_scanner", filter, data.size(), [&] () {
+		ps_scanner scanner;
+		for (size_t i = 0; i < data.size(); i += 8192) {
+			scanner.feed(data.data() + i, 8192);
+		}
+
+		if (scanner.images().size() != 1) {
+			throw runtime_error("image not found");
+		}
+	});
+}
+
+const string gws_magic = "6u9E9eWF0bt9Y8Rw690Le4669JYe4d-056T9p4ijm4EA6u9ee659jn9E-54e4j6rPj069K-670";
+
+// builds a gwsettings body, consisting of all known groups. each group is
+// zero-filled, which is a valid encoding for almost all nv_val types.
+string make_groups()
+{
+	string ret;
+
+	for (auto g : nv_group::registry()) {
+		for (uint16_t size : { 64, 256, 1024 }) {
+			string group = to_buf(htons(size)) + g.first.to_str() + to_buf(htons(0x0001))
+					+ string(size - 8, '\0');
+
+			istringstream istr(group);
+			sp<nv_group> tmp;
+
+			try {
+				if (nv_group::read(istr, tmp, nv_group::type_cfg, group.size())) {
+					ret += group;
+					break;
+				}
+			} catch (const exception& e) {
+				// try next size
+			}
+		}
+	}
+
+	return ret;
+}
+
+// collects the names of all values that are set
+void collect_names(const nv_compound& c, const string& prefix, vector<string>& names)
+{
+	for (auto& p : c.parts()) {
+		if (p.val->is_disabled() || !p.val->is_set()) {
+			continue;
+		} else if (p.val->is_compound()) {
+			collect_names(dynamic_cast<const nv_compound&>(*p.val), prefix + p.name + ".", names);
+		} else {
+			names.push_back(prefix + p.name);
+		}
+	}
+}
+
+string make_gwsettings(const string& groups, const profile::sp& p, const string& key)
+{
+	string buf = gws_magic + to_buf(htons(0x0006)) + to_buf(htonl(gws_magic.size() + 6 + groups.size())) + groups;
+
+	if (!key.empty()) {
+		AES_KEY aes;
+		AES_set_encrypt_key(reinterpret_cast<const unsigned char*>(key.data()), 256, &aes);
+		for (size_t i = 0; (i + 16) <= buf.size(); i += 16) {
+			auto block = reinterpret_cast<unsigned char*>(&buf[i]);
+			AES_encrypt(block, block, &aes);
+		}
+	}
+
+	string md5key = p->md5_key();
+	string md5(16, '\0');
+	MD5_CTX c;
+	MD5_Init(&c);
+	MD5_Update(&c, buf.data(), buf.size());
+	MD5_Update(&c, md5key.data(), md5key.size());
+	MD5_Final(reinterpret_cast<unsigned char*>(&md5[0]), &c);
+
+	return md5 + buf;
+}
+
+void bench_nonvol(const string& filter)
+{
+	auto p = profile::get("tc7200");
+	string groups = make_groups();
+	string plain = make_gwsettings(groups, p, "");
+	string encrypted = make_gwsettings(groups, p, p->default_keys()[0]);
+
+	run("nonvol/gwsettings/read", filter, plain.size(), [&] () {
+		istringstream istr(plain);
+		auto s = settings::read(istr, nv_group::type_cfg, p, "");
+		if (s->parts().empty()) {
+			throw runtime_error("no groups");
+		}
+	});
+
+	// like reading from a mapped_file
+	run("nonvol/gwsettings/read_mem", filter, plain.size(), [&] () {
+		imemstream istr(plain);
+		auto s = settings::read(istr, nv_group::type_cfg, p, "");
+		if (s->parts().empty()) {
+			throw runtime_error("no groups");
+		}
+	});
+
+	run("nonvol/gwsettings/read_lazy", filter, plain.size(), [&] () {
+		istringstream istr(plain);
+		auto s = settings::read(istr, nv_group::type_cfg, p, "", true);
+		if (s->parts().empty()) {
+			throw runtime_error("no groups");
+		}
+	});
+
+	// a config with a lot of groups, like a device with large log groups
+	string large_groups;
+	for (unsigned i = 0; i < 32; ++i) {
+		large_groups += groups;
+	}
+	string large = make_gwsettings(large_groups, p, "");
+
+	run("nonvol/gwsettings/read_large", filter, large.size(), [&] () {
+		istringstream istr(large);
+		auto s = settings::read(istr, nv_group::type_cfg, p, "");
+		if (s->parts().empty()) {
+			throw runtime_error("no groups");
+		}
+	});
+
+	run("nonvol/gwsettings/read_large_mem", filter, large.size(), [&] () {
+		imemstream istr(large);
+		auto s = settings::read(istr, nv_group::type_cfg, p, "");
+		if (s->parts().empty()) {
+			throw runtime_error("no groups");
+		}
+	});
+
+	run("nonvol/gwsettings/read_aes", filter, encrypted.size(), [&] () {
+		istringstream istr(encrypted);
+		auto s = settings::read(istr, nv_group::type_cfg, p, "");
+		if (s->parts().empty()) {
+			throw runtime_error("no groups");
+		}
+	});
+
+	run("nonvol/gwsettings/read_aes_autodetect", filter, encrypted.size(), [&] () {
+		istringstream istr(encrypted);
+		auto s = settings::read(istr, nv_group::type_cfg, nullptr, "");
+		if (s->parts().empty()) {
+			throw runtime_error("no groups");
+		}
+	});
+
+	istringstream istr(plain);
+	auto s = settings::read(istr, nv_group::type_cfg, p, "");
+
+	run("nonvol/nv_compound/write", filter, groups.size(), [&] () {
+		ostringstream ostr;
+		for (auto part : s->parts()) {
+			part.val->write(ostr);
+		}
+		sink = ostr.tellp();
+	});
+
+	run("nonvol/nv_compound/to_pretty", filter, groups.size(), [&] () {
+		sink = s->to_pretty().size();
+	});
+
+	vector<string> names;
+	collect_names(*s, "", names);
+
+	// the bytes are the number of values
+	run("nonvol/nv_compound/find", filter, names.size(), [&] () {
+		for (auto& name : names) {
+			sink = !!s->find(name);
+		}
+	});
+
+	vector<nv_path> paths;
+	for (auto& name : names) {
+		paths.emplace_back(name);
+	}
+
+	run("nonvol/nv_compound/find_path", filter, paths.size(), [&] () {
+		for (auto& path : paths) {
+			sink = !!s->find(path);
+		}
+	});
+}
+
+void bench_nv_arena(const string& filter)
+{
+	// a large first value, such as a nested compound, must not keep the
+	// arena from growing its blocks
+	run("nonvol/nv_arena/large_first", filter, 0, [&] () {
+		nv_arena::scope scope;
+		vector<sp<nv_val>> vals;
+		vals.push_back(nv_make<nv_array<nv_u8, 4>>());
+		for (unsigned i = 0; i < 1000; ++i) {
+			vals.push_back(nv_make<nv_u8>());
+		}
+
+		size_t blocks = nv_arena::current()->blocks();
+		if (blocks > 16) {
+			throw runtime_error("too many arena blocks: " + to_string(blocks));
+		}
+	});
+}
+
+void usage()
+{
+	cerr << "Usage: bcm2bench [-v] [-t <millis>] [<filter>]" << endl;
+	cerr << endl;
+	cerr << "Runs all benchmarks whose name contains <filter>, and prints" << endl;
+	cerr << "the results to standard output in JSON format." << endl;
+}
+}
+
+int main(int argc, char** argv)
+{
+	string filter;
+	int opt;
+
+	logger::loglevel(logger::warn);
+
+	while ((opt = getopt(argc, argv, "hvt:")) != -1) {
+		switch (opt) {
+		case 'v':
+			logger::loglevel(logger::verbose);
+			break;
+		case 't':
+			min_millis = lexical_cast<unsigned>(optarg);
+			break;
+		case 'h':
+		default:
+			usage();
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (optind < argc) {
+		filter = argv[optind];
+	}
+
+	try {
+		bench_util(filter);
+		bench_ps(filter);
+		bench_nonvol(filter);
+		bench_nv_arena(filter);
+		bench_rwx(filter);
+	} catch (const exception& e) {
+		logger::e() << "error: " << e.what() << endl;
+		return 1;
+	}
+
+	print_json(cout);
+
+	bool failed = false;
+	for (auto r : results) {
+		if (!r.error.empty()) {
+			logger::e() << r.name << ": " << r.error << endl;
+			failed = true;
+		}
+	}
+
+	return failed ? 1 : 0;
+}
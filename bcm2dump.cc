@@ -1,8 +1,13 @@
+#include <sys/stat.h>
 #include <stdexcept>
 #include <iostream>
 #include <fstream>
+#include <future>
 #include "interface.h"
 #include "bcm2dump.h"
+#include "container.h"
+#include "metrics.h"
+#include "store.h"
 #include "rwx.h"
 #include "io.h"
 using namespace std;
@@ -19,6 +24,57 @@ const unsigned opt_force = (1 << 1);
 const unsigned opt_safe = (1 << 2);
 const unsigned opt_force_write = (1 << 3);
 
+// output type, as passed to sink::create()
+string output_type = "stream";
+// JSON-lines event stream, as specified using -J
+unique_ptr<ofstream> event_stream;
+// metrics report, as specified using -M
+string metrics_file;
+
+// a single line in the event stream. all events have a "time" (monotonic,
+// in milliseconds) and an "event" field.
+class event
+{
+	public:
+	event(const string& type)
+	{
+		m_line << "{\"time\":" << progress_millis();
+		(*this)("event", type);
+	}
+
+	event& operator()(const string& key, uint64_t val)
+	{
+		m_line << ",\"" << key << "\":" << val;
+		return *this;
+	}
+
+	event& operator()(const string& key, const string& val)
+	{
+		m_line << ",\"" << key << "\":\"";
+
+		for (char c : val) {
+			if (c == '"' || c == '\\') {
+				m_line << '\\' << c;
+			} else if (static_cast<unsigned char>(c) >= 0x20) {
+				m_line << c;
+			}
+		}
+
+		m_line << "\"";
+		return *this;
+	}
+
+	void emit()
+	{
+		if (event_stream) {
+			*event_stream << m_line.str() << "}" << endl;
+		}
+	}
+
+	private:
+	ostringstream m_line;
+};
+
 void usage(bool help = false)
 {
 	ostream& os = logger::i();
@@ -30,6 +86,13 @@ void usage(bool help = false)
 	os << "  -R               Resume dump" << endl;
 	os << "  -F               Force operation" << endl;
 	os << "  -P <profile>     Force profile" << endl;
+	os << "  -L <file>        Record session to <file>" << endl;
+	os << "  -X <faults>      Inject faults (e.g. drop=0.001,junk=0.01)" << endl;
+	os << "  -J <file>        Write progress events to <file>, as JSON lines" << endl;
+	os << "  -M <file>        Write timing and traffic metrics to <file>, as JSON" << endl;
+	os << "  -O <output>      Dump output: stream (default), file, or mmap;" << endl;
+	os << "                   append ,sparse to file or mmap to skip zero blocks." << endl;
+	os << "                   Use container for a compressed, seekable file" << endl;
 	os << "  -q               Decrease verbosity" << endl;
 	os << "  -v               Increase verbosity" << endl;
 	os << endl;
@@ -40,12 +103,44 @@ void usage(bool help = false)
 				"    alternately a partition name. If a partition name is used, the <size>\n"
 				"    argument may be omitted. Data is stored in <outfile>.\n\n";
 	}
+	os << "  dumpall <interface> <addrspace> {all,<partition>[,<partition> ...]} <outdir>" << endl;
+	if (help) {
+		os << "\n    Dump multiple partitions of the given address space in one session, using\n"
+				"    either a comma-separated list of partitions, or all partitions of known\n"
+				"    size. Each partition is stored in <outdir>/<partition>.bin, and a list of\n"
+				"    all files, including their CRC32, is written to <outdir>/manifest.txt.\n\n";
+	}
+	os << "  store <interface> <addrspace> {<partition>[+<offset>],<offset>}[,<size>] <storedir> <name>" << endl;
+	if (help) {
+		os << "\n    Dump data to a deduplicating block store in <storedir>. The dump is split\n"
+				"    into 64k blocks, each of which is stored only once. The list of blocks is\n"
+				"    saved as <storedir>/manifests/<name>. If possible, the CRC32 of each block\n"
+				"    is calculated on the device first, and blocks that are already in the\n"
+				"    store are not dumped again.\n\n";
+	}
+	os << "  extract <storedir> <name> <outfile>" << endl;
+	if (help) {
+		os << "\n    Reassemble a dump from a block store, verifying each block's checksum.\n\n";
+	}
 	os << "  write <interface> <addrspace> {<partition>[+<offset>],<offset>}[,<size>] <infile>" << endl;
 	if (help) {
 		os << "\n    Write data to the specified address space, starting at either an explicit\n"
 				"    offset or alternately a partition name. The <size> argument may be used to\n"
 				"    use only parts of <infile>.\n\n";
 	}
+	os << "  verify <interface> <addrspace> {<partition>[+<offset>],<offset>}[,<size>] <infile> [<blocksize>]" << endl;
+	if (help) {
+		os << "\n    Compare data in the given address space against <infile>, without dumping it.\n"
+				"    If possible, a CRC32 of each <blocksize> (default 64k) block is calculated\n"
+				"    on the device. If <size> is omitted, the size of <infile> is used.\n\n";
+	}
+	os << "  search <interface> <addrspace> {<partition>[+<offset>],<offset>}[,<size>] <pattern> [<pattern> ...]" << endl;
+	if (help) {
+		os << "\n    Search the given address space for one or more patterns, and print the\n"
+				"    offset of each match. If possible, the search is performed on the device.\n"
+				"    Patterns starting with 0x are interpreted as hex bytes, otherwise as a\n"
+				"    string.\n\n";
+	}
 	os << "  exec  <interface> {<partition>,<offset>}[,<entry>] <infile>" << endl;
 	if (help) {
 		os << "\n    Write data to ram, starting at either an explicit offset or alternately a\n"
@@ -58,6 +153,17 @@ void usage(bool help = false)
 		os << "\n    Print information about a profile. In the absence of a -P flag, use\n"
 				"    auto-detection.\n\n";
 	}
+	os << "  scan  <infile> [<offset>]" << endl;
+	if (help) {
+		os << "\n    Scan a dump for ProgramStore images, and validate their checksums. An\n"
+				"    <offset> argument may be supplied to specify the dump's start address.\n\n";
+	}
+	os << "  unpack <infile> <outfile> [{<partition>[+<offset>],<offset>}[,<size>]]" << endl;
+	if (help) {
+		os << "\n    Extract data from a container written using -O container. Without a range\n"
+				"    argument, the whole dump is extracted; partition names and offsets refer\n"
+				"    to the device that was dumped.\n\n";
+	}
 	os << "  help" << endl;
 	if (help) {
 		os << "\n    Print this information and exit.\n";
@@ -69,6 +175,9 @@ void usage(bool help = false)
 	os << "  192.168.0.1,2323         Raw TCP connection to 192.168.0.1, port 2323" << endl;
 	os << "  192.168.0.1,foo,bar      Telnet, server 192.168.0.1, user 'foo', password 'bar'" << endl;
 	os << "  192.168.0.1,foo,bar,233  Same as above, port 233" << endl;
+	os << "  replay:session.bin       Replay session recorded using -L" << endl;
+	os << "  replay:session.bin,realtime" << endl;
+	os << "                           Same as above, at the recorded speed" << endl;
 	os << endl;
 	os << "bcm2dump " << VERSION << " Copyright (C) 2016 Joseph C. Lehner" << endl;
 	os << "Licensed under the GNU GPLv3; source code is available at" << endl;
@@ -100,6 +209,122 @@ void handle_interrupt()
 	logger::w() << endl << "interrupted" << endl;
 }
 
+void print_images(const vector<ps_scanner::image>& images)
+{
+	printf("%-10s  %-6s  %10s  %-4s  %-4s  %-9s  %s\n", "offset", "sig", "length", "comp", "dual", "crc", "filename");
+
+	for (auto& img : images) {
+		printf("0x%08x  0x%04x  %10u  %4u  %-4s  %-9s  %s\n", img.offset, img.hdr.signature(), img.hdr.length(),
+				img.hdr.compression(), img.hdr.is_dual() ? "yes" : "no",
+				!img.complete ? "truncated" : (img.crc_valid ? "ok" : "BAD"), img.hdr.filename().c_str());
+	}
+}
+
+void print_stats(const rwx::sp& rwx)
+{
+	const rwx::stats& st = rwx->last_stats();
+	if (!st.chunks) {
+		return;
+	}
+
+	event("done")("bytes", st.bytes)("chunks", st.chunks)("retries", st.retries)("millis", st.millis).emit();
+
+	// formatted separately, so that the fill character doesn't stick to logger::v()
+	ostringstream secs;
+	secs << (st.millis / 1000) << "." << setw(3) << setfill('0') << (st.millis % 1000);
+
+	logger::v() << endl << st.bytes << " b in " << st.chunks << " chunks, " << st.retries << " retries, "
+			<< secs.str() << " s ("
+			<< (st.millis ? (st.bytes * 1000 / st.millis) : 0) << " b/s)" << endl;
+}
+
+// renders progress to stdout (unless -q was specified), and to the event
+// stream. both are rate limited, so that fast transfers aren't slowed down
+// by printing. if <verb> is null, it's derived from the direction.
+void set_progress_listener(const rwx::sp& rwx, progress& pg, const char* verb, const string& space)
+{
+	bool print = logger::loglevel() <= logger::info;
+	if (!print && !event_stream) {
+		return;
+	}
+
+	rwx->set_progress_listener([&pg, verb, space, print] (uint32_t offset, uint32_t length, bool write, bool init) {
+		if (init) {
+			const char* v = verb ? verb : (write ? "writing" : "reading");
+			progress_init(&pg, offset, length);
+			if (print) {
+				printf("%s %s:0x%08x-0x%08x (%d b)\n", v, space.c_str(), pg.min, pg.max, pg.max + 1 - pg.min);
+			}
+
+			event("phase")("phase", v)("space", space)("offset", pg.min)("length", pg.max + 1 - pg.min).emit();
+		}
+
+		progress_set(&pg, offset);
+
+		if (!progress_print_due(&pg, 100)) {
+			return;
+		}
+
+		if (print) {
+			printf("\r ");
+			progress_print(&pg, stdout);
+		}
+
+		event("progress")("offset", pg.cur)("bytes", pg.cur - pg.min)("rate", pg.speed_now)
+				("avg", pg.speed_avg)("eta_ms", progress_eta_millis(&pg)).emit();
+	});
+
+	if (event_stream) {
+		rwx->set_chunk_listener([] (uint32_t offset, uint32_t length, unsigned millis, unsigned retries) {
+			event("chunk")("offset", offset)("length", length)("millis", millis)("retries", retries).emit();
+		});
+	}
+}
+
+// opens the output file, using the output type specified using -O
+sink::sp open_output(const string& filename, int opts)
+{
+	if (output_type == "container") {
+		if (opts & opt_resume) {
+			throw user_error("resume is not supported with containers");
+		}
+
+		return make_shared<container_writer>(filename);
+	}
+
+	return sink::create(output_type, filename, opts & opt_resume);
+}
+
+// completes a container, by adding the dump's metadata. images outside
+// of the given range are ignored.
+void close_output(const sink::sp& out, const interface::sp& intf, const rwx::sp& rwx,
+		uint32_t offset, uint32_t length, const vector<ps_scanner::image>& images)
+{
+	auto container = dynamic_pointer_cast<container_writer>(out);
+	if (!container) {
+		return;
+	}
+
+	container_metadata meta;
+	meta.version = VERSION;
+	meta.profile = intf->profile() ? intf->profile()->name() : "generic";
+	meta.space = rwx->space().name();
+	meta.offset = offset;
+
+	for (auto& p : rwx->space().partitions()) {
+		meta.partitions.push_back({ p.name(), p.offset(), p.size() });
+	}
+
+	for (auto& img : images) {
+		if (img.offset >= offset && (img.offset - offset) < length) {
+			meta.images.push_back({ img.offset, img.hdr.length(), img.hdr.signature(),
+					img.complete && img.crc_valid, img.hdr.filename() });
+		}
+	}
+
+	container->close(meta);
+}
+
 int do_dump(int argc, char** argv, int opts, const string& profile)
 {
 	if (argc != 5) {
@@ -111,19 +336,7 @@ int do_dump(int argc, char** argv, int opts, const string& profile)
 		throw user_error("output file "s + argv[4] + " exists; specify -F to overwrite or -R to resume dump");
 	}
 
-	ios::openmode mode = ios::out | ios::binary;
-	if (opts & opt_resume) {
-		// without ios::in, the file will be overwritten!
-		mode |= ios::in;
-	} else if (opts & opt_force) {
-		mode |= ios::trunc;
-	}
-
-	ofstream of(argv[4], mode);
-	if (!of.good()) {
-		throw user_error("failed to open "s + argv[4] + " for writing");
-	}
-
+	auto out = open_output(argv[4], opts);
 	auto intf = interface::create(argv[1], profile);
 	rwx::sp rwx;
 
@@ -134,34 +347,377 @@ int do_dump(int argc, char** argv, int opts, const string& profile)
 	}
 
 	progress pg;
+	set_progress_listener(rwx, pg, "dumping", argv[2]);
 
-	if (logger::loglevel() <= logger::info) {
-		rwx->set_progress_listener([&pg, &argv] (uint32_t offset, uint32_t length, bool write, bool init) {
-			if (init) {
-				progress_init(&pg, offset, length);
-				printf("dumping %s:0x%08x-0x%08x (%d b)\n", argv[2], pg.min, pg.max, pg.max + 1 - pg.min);
-			}
+	vector<ps_scanner::image> images;
 
-			printf("\r ");
-			progress_set(&pg, offset);
-			progress_print(&pg, stdout);
-		});
+	rwx->set_image_listener([&images] (const ps_scanner::image& img) {
+		if (!img.complete) {
+			images.push_back(img);
+			if (logger::loglevel() <= logger::info) {
+				printf("\n  found %s (0x%04x, %u b) at 0x%08x\n", img.hdr.filename().c_str(),
+						img.hdr.signature(), img.hdr.length(), img.offset);
+			}
+		} else {
+			for (auto& i : images) {
+				if (i.offset == img.offset) {
+					i.complete = true;
+					i.crc_valid = img.crc_valid;
+				}
+			}
+		}
+	});
 
-		rwx->set_image_listener([] (uint32_t offset, const ps_header& hdr) {
-			printf("  %s (0x%04x, %d b)\n", hdr.filename().c_str(), hdr.signature(), hdr.length());
-		});
-	}
+	uint32_t offset = 0, length = 0;
 
 	if (argv[2] != "special"s) {
 		if (argv[3] != "dumpcode"s) {
-			rwx->dump(argv[3], of, opts & opt_resume);
+			rwx->parse_spec(argv[3], offset, length);
 		} else {
-			rwx->dump(intf->profile()->codecfg(intf->id()).loadaddr | intf->profile()->kseg1(), 512, of);
+			offset = intf->profile()->codecfg(intf->id()).loadaddr | intf->profile()->kseg1();
+			length = 512;
 		}
-	} else {
-		rwx->dump(0, 0, of);
 	}
+
+	rwx->dump(offset, length, *out, opts & opt_resume);
+	close_output(out, intf, rwx, offset, length, images);
 	logger::i() << endl;
+	print_stats(rwx);
+
+	if (!images.empty() && logger::loglevel() <= logger::info) {
+		printf("\n");
+		print_images(images);
+	}
+
+	return 0;
+}
+
+struct manifest_entry
+{
+	string name;
+	uint32_t offset;
+	uint32_t size;
+	uint32_t crc;
+	string filename;
+};
+
+// calculates the checksum of the dumped data (rather than that of the
+// output file, which may be a container), as it is written.
+class crc32_sink : public sink
+{
+	public:
+	crc32_sink(const sink::sp& out) : m_out(out) {}
+
+	virtual uint64_t size() override
+	{ return m_out->size(); }
+
+	virtual void reserve(uint64_t size) override
+	{ m_out->reserve(size); }
+
+	virtual void write(uint64_t offset, const char* buf, size_t length) override
+	{
+		m_out->write(offset, buf, length);
+
+		if (offset != m_pos) {
+			m_complete = false;
+		} else if (m_complete) {
+			m_crc.update(buf, length);
+			m_pos += length;
+		}
+	}
+
+	virtual void finish() override
+	{ m_out->finish(); }
+
+	virtual bool positional() const override
+	{ return m_out->positional(); }
+
+	// false if the data wasn't written sequentially, starting at
+	// offset 0 (i.e. if the dump was resumed).
+	bool complete() const
+	{ return m_complete; }
+
+	uint64_t pos() const
+	{ return m_pos; }
+
+	uint32_t crc() const
+	{ return m_crc.value(); }
+
+	private:
+	sink::sp m_out;
+	crc32_stream m_crc;
+	uint64_t m_pos = 0;
+	bool m_complete = true;
+};
+
+// closes the file, and returns the checksum of its data
+manifest_entry finish_target(sink::sp out, shared_ptr<crc32_sink> crc, const addrspace::part& p,
+		const string& filename)
+{
+	manifest_entry ret = { p.name(), p.offset(), uint32_t(crc->pos()), crc->crc(), filename };
+	bool complete = crc->complete();
+
+	// both hold a reference to the output
+	crc.reset();
+	out.reset();
+
+	if (complete) {
+		return ret;
+	}
+
+	// resumed dumps are never containers, so the file itself can be used
+	ifstream in(filename, ios::binary);
+	crc32_stream file_crc;
+	string buf(1024 * 1024, '\0');
+
+	ret.size = 0;
+
+	while (in.read(&buf[0], buf.size()) || in.gcount()) {
+		file_crc.update(buf.data(), in.gcount());
+		ret.size += in.gcount();
+	}
+
+	ret.crc = file_crc.value();
+	return ret;
+}
+
+int do_dumpall(int argc, char** argv, int opts, const string& profile)
+{
+	if (argc != 5) {
+		usage(false);
+		return 1;
+	}
+
+	auto intf = interface::create(argv[1], profile);
+	auto rwx = rwx::create(intf, argv[2], opts & opt_safe);
+
+	vector<addrspace::part> parts;
+
+	if (argv[3] == "all"s) {
+		for (auto& p : rwx->space().partitions()) {
+			if (p.size()) {
+				parts.push_back(p);
+			}
+		}
+	} else {
+		for (string name : split(argv[3], ',')) {
+			const addrspace::part& p = rwx->space().partition(name);
+			if (!p.size()) {
+				throw user_error("size of partition '" + p.name() + "' is unknown");
+			}
+			parts.push_back(p);
+		}
+	}
+
+	if (parts.empty()) {
+		throw user_error("no partitions of known size in address space "s + argv[2]);
+	}
+
+	string dir = argv[4];
+	if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+		throw errno_error("failed to create " + dir);
+	}
+
+	if (!(opts & (opt_force | opt_resume))) {
+		for (auto& p : parts) {
+			string filename = dir + "/" + p.name() + ".bin";
+			if (access(filename.c_str(), F_OK) == 0) {
+				throw user_error("output file " + filename + " exists; specify -F to overwrite or -R to resume dump");
+			}
+		}
+	}
+
+	progress pg;
+	set_progress_listener(rwx, pg, "dumping", argv[2]);
+
+	vector<ps_scanner::image> images;
+
+	rwx->set_image_listener([&images] (const ps_scanner::image& img) {
+		if (!img.complete) {
+			images.push_back(img);
+		} else {
+			for (auto& i : images) {
+				if (i.offset == img.offset) {
+					i.complete = true;
+					i.crc_valid = img.crc_valid;
+				}
+			}
+		}
+	});
+
+	vector<future<manifest_entry>> entries;
+
+	for (auto& p : parts) {
+		string filename = dir + "/" + p.name() + ".bin";
+		auto out = open_output(filename, opts);
+		auto crc = make_shared<crc32_sink>(out);
+
+		logger::i() << p.name() << ": ";
+		rwx->dump(p.name(), *crc, opts & opt_resume);
+		close_output(out, intf, rwx, p.offset(), p.size(), images);
+		logger::i() << endl;
+		print_stats(rwx);
+
+		// finish this file while the next partition is being dumped
+		entries.push_back(async(launch::async, &finish_target, move(out), move(crc), p, filename));
+	}
+
+	ofstream manifest(dir + "/manifest.txt");
+	manifest << "# bcm2dump " << VERSION << ", " << intf->profile()->name() << ", " << argv[2] << endl;
+	manifest << "# partition offset size crc32 file" << endl;
+
+	for (auto& f : entries) {
+		manifest_entry e = f.get();
+		manifest << e.name << " 0x" << to_hex(e.offset) << " " << e.size << " 0x" << to_hex(e.crc)
+				<< " " << e.filename.substr(dir.size() + 1) << endl;
+	}
+
+	if (!manifest.good()) {
+		throw user_error("failed to write " + dir + "/manifest.txt");
+	}
+
+	if (!images.empty() && logger::loglevel() <= logger::info) {
+		printf("\n");
+		print_images(images);
+	}
+
+	return 0;
+}
+
+int do_store(int argc, char** argv, int opts, const string& profile)
+{
+	if (argc != 6) {
+		usage(false);
+		return 1;
+	}
+
+	string name = argv[5];
+	if (name.empty() || name[0] == '.' || name.find('/') != string::npos) {
+		throw user_error("invalid manifest name '" + name + "'");
+	}
+
+	block_store store(argv[4]);
+	string manifest = argv[4] + "/manifests/"s + name;
+
+	if (access(manifest.c_str(), F_OK) == 0 && !(opts & opt_force)) {
+		throw user_error("manifest " + manifest + " exists; specify -F to overwrite");
+	}
+
+	auto intf = interface::create(argv[1], profile);
+	auto rwx = rwx::create(intf, argv[2], opts & opt_safe);
+
+	uint32_t offset, length;
+	rwx->parse_spec(argv[3], offset, length);
+
+	progress pg;
+	set_progress_listener(rwx, pg, "dumping", argv[2]);
+
+	const uint32_t block_size = 64 * 1024;
+	uint32_t count = (uint64_t(length) + block_size - 1) / block_size;
+	vector<uint32_t> remote;
+
+	// if the device can tell us the crc of each block, we only
+	// need to dump those blocks that we don't have yet
+	if (rwx->capabilities() & rwx::cap_checksum) {
+		remote = rwx->checksum(offset, length, block_size);
+		logger::i() << endl;
+		if (remote.size() != count) {
+			throw runtime_error("expected " + to_string(count) + " checksums, got " + to_string(remote.size()));
+		}
+	}
+
+	block_store::manifest blocks;
+	store_sink out(store, offset, block_size);
+	unsigned skipped = 0;
+
+	for (uint32_t i = 0; i < count;) {
+		uint32_t n = min(block_size, length - i * block_size);
+
+		if (!remote.empty()) {
+			string hash = store.lookup(remote[i], n);
+			if (!hash.empty() && store.contains(hash)) {
+				blocks.push_back({ offset + i * block_size, n, remote[i], hash });
+				++skipped;
+				++i;
+				continue;
+			}
+		}
+
+		// dump all consecutive blocks that are missing
+		uint32_t k = remote.empty() ? count : i + 1;
+		while (k < count && store.lookup(remote[k], min(block_size, length - k * block_size)).empty()) {
+			++k;
+		}
+
+		uint32_t run = min(length, k * block_size) - i * block_size;
+		out.set_origin(i * block_size);
+		rwx->dump(offset + i * block_size, run, out);
+		logger::i() << endl;
+		i = k;
+	}
+
+	for (auto& b : out.blocks()) {
+		uint32_t i = (b.offset - offset) / block_size;
+		if (!remote.empty() && b.crc != remote[i]) {
+			throw runtime_error("crc mismatch in block at 0x" + to_hex(b.offset) + ": 0x"
+					+ to_hex(b.crc) + ", expected 0x" + to_hex(remote[i]));
+		}
+		blocks.push_back(b);
+	}
+
+	sort(blocks.begin(), blocks.end(), [] (const block_store::block& a, const block_store::block& b) {
+		return a.offset < b.offset;
+	});
+
+	string comment = "bcm2dump "s + VERSION + ", " + (intf->profile() ? intf->profile()->name() : "generic")
+			+ ", " + argv[2] + ", 0x" + to_hex(offset) + "," + to_string(length);
+	store.write_manifest(name, comment, blocks);
+
+	logger::i() << "stored " << blocks.size() << " blocks, " << skipped << " of which were not dumped" << endl;
+	return 0;
+}
+
+int do_extract(int argc, char** argv, int opts)
+{
+	if (argc != 4) {
+		usage(false);
+		return 1;
+	}
+
+	if (access(argv[3], F_OK) == 0 && !(opts & opt_force)) {
+		throw user_error("output file "s + argv[3] + " exists; specify -F to overwrite");
+	}
+
+	block_store store(argv[1]);
+	auto blocks = store.read_manifest(argv[2]);
+
+	ofstream out(argv[3], ios::binary | ios::trunc);
+	if (!out.good()) {
+		throw user_error("failed to open "s + argv[3] + " for writing");
+	}
+
+	uint64_t size = 0;
+
+	for (auto& b : blocks) {
+		if (b.offset != blocks[0].offset + size) {
+			throw runtime_error("gap in manifest at 0x" + to_hex(b.offset));
+		}
+
+		string buf = store.get(b.hash);
+		if (buf.size() != b.size || crc32_ieee(buf) != b.crc) {
+			throw runtime_error("block at 0x" + to_hex(b.offset) + " does not match manifest");
+		}
+
+		out.write(buf.data(), buf.size());
+		size += buf.size();
+	}
+
+	out.close();
+	if (!out) {
+		throw user_error("failed to write "s + argv[3]);
+	}
+
+	logger::i() << "extracted " << size << " b from " << blocks.size() << " blocks" << endl;
 	return 0;
 }
 
@@ -176,30 +732,293 @@ int do_write(int argc, char** argv, int opts, const string& profile)
 		throw user_error("writing to non-ram address space "s + argv[2] + " is dangerous; specify -FF to continue");
 	}
 
+	// map regular files, and stream everything else
+	unique_ptr<mapped_file> map;
+	ifstream in;
+
+	try {
+		map.reset(new mapped_file(argv[4]));
+	} catch (const errno_error& e) {
+		logger::d() << e.what() << "; reading as stream" << endl;
+		in.open(argv[4], ios::binary);
+		if (!in.good()) {
+			throw user_error("failed to open "s + argv[4] + " for reading");
+		}
+	}
+
+	auto intf = interface::create(argv[1]);
+	auto rwx = rwx::create(intf, argv[2], true);
+
+	progress pg;
+	set_progress_listener(rwx, pg, nullptr, argv[2]);
+
+	if (map) {
+		rwx->write(argv[3], map->data(), map->size());
+	} else {
+		rwx->write(argv[3], in);
+	}
+
+	print_stats(rwx);
+	return 0;
+}
+
+int do_verify(int argc, char** argv, int opts, const string& profile)
+{
+	if (argc != 5 && argc != 6) {
+		usage(false);
+		return 1;
+	}
+
 	ifstream in(argv[4], ios::binary);
 	if (!in.good()) {
 		throw user_error("failed to open "s + argv[4] + " for reading");
 	}
 
-	auto intf = interface::create(argv[1]);
-	auto rwx = rwx::create(intf, argv[2], true);
+	uint32_t block_size = argc == 6 ? lexical_cast<uint32_t>(argv[5], 0) : 64 * 1024;
+	if (!block_size) {
+		throw user_error("invalid block size "s + argv[5]);
+	}
+
+	in.seekg(0, ios::end);
+	uint64_t size = in.tellg();
+	in.seekg(0, ios::beg);
+
+	// an empty range would be expanded to the whole partition
+	if (!size || size > 0xffffffff) {
+		throw user_error("invalid size of "s + argv[4] + " (" + to_string(size) + " b)");
+	}
+
+	string spec = argv[3];
+	uint32_t length;
+
+	auto tokens = split(spec, ',');
+	if (tokens.size() == 2) {
+		length = lexical_cast<uint32_t>(tokens[1], 0);
+		// check this now, rather than after the (slow) checksum pass
+		if (size != length) {
+			throw user_error("size of "s + argv[4] + " (" + to_string(size) + " b) doesn't match range ("
+					+ to_string(length) + " b)");
+		}
+	} else {
+		length = size;
+		spec += "," + to_string(length);
+	}
+
+	auto intf = interface::create(argv[1], profile);
+	auto rwx = rwx::create(intf, argv[2], opts & opt_safe);
 
 	progress pg;
+	set_progress_listener(rwx, pg, "verifying", argv[2]);
 
-	if (logger::loglevel() <= logger::info) {
-		rwx->set_progress_listener([&pg, &argv] (uint32_t offset, uint32_t length, bool write, bool init) {
-			if (init) {
-				progress_init(&pg, offset, length);
-				printf("%s %s:0x%08x-0x%08x (%d b)\n", write ? "writing" : "reading", argv[2], pg.min, pg.max, pg.max + 1 - pg.min);
+	vector<uint32_t> remote = rwx->checksum(spec, block_size);
+	logger::i() << endl;
+	print_stats(rwx);
+
+	uint32_t count = (uint64_t(length) + block_size - 1) / block_size;
+	if (remote.size() != count) {
+		throw runtime_error("expected " + to_string(count) + " checksums, got " + to_string(remote.size()));
+	}
+
+	string buf(block_size, '\0');
+	unsigned mismatches = 0;
+
+	for (uint32_t i = 0; i < count; ++i) {
+		uint32_t n = min(block_size, length - i * block_size);
+		if (!in.read(&buf[0], n)) {
+			throw user_error("failed to read "s + to_string(n) + " bytes from " + argv[4]);
+		}
+
+		uint32_t local = crc32_ieee(buf.data(), n);
+		if (local != remote[i]) {
+			logger::w() << "mismatch at +0x" << to_hex(i * block_size) << " (" << n << " b): crc 0x"
+					<< to_hex(remote[i], 8) << ", expected 0x" << to_hex(local, 8) << endl;
+			++mismatches;
+		}
+	}
+
+	if (mismatches) {
+		logger::w() << mismatches << "/" << count << " blocks differ" << endl;
+		return 1;
+	}
+
+	logger::i() << "all " << count << " blocks match" << endl;
+	return 0;
+}
+
+string parse_pattern(const string& arg)
+{
+	if (arg.size() <= 2 || arg.substr(0, 2) != "0x") {
+		return arg;
+	}
+
+	if (arg.size() % 2) {
+		throw user_error("odd number of hex digits in pattern '" + arg + "'");
+	}
+
+	string ret;
+	for (string::size_type i = 2; i < arg.size(); i += 2) {
+		ret += char(lexical_cast<unsigned>(arg.substr(i, 2), 16));
+	}
+
+	return ret;
+}
+
+int do_search(int argc, char** argv, int opts, const string& profile)
+{
+	if (argc < 5) {
+		usage(false);
+		return 1;
+	}
+
+	vector<string> patterns;
+	for (int i = 4; i < argc; ++i) {
+		patterns.push_back(parse_pattern(argv[i]));
+	}
+
+	auto intf = interface::create(argv[1], profile);
+	auto rwx = rwx::create(intf, argv[2], opts & opt_safe);
+
+	progress pg;
+	set_progress_listener(rwx, pg, "searching", argv[2]);
+
+	auto matches = rwx->search(argv[3], patterns);
+	logger::i() << endl;
+	print_stats(rwx);
+
+	for (auto& m : matches) {
+		printf("0x%08x  %s\n", m.offset, argv[4 + m.pattern]);
+	}
+
+	return matches.empty() ? 1 : 0;
+}
+
+int do_scan(int argc, char** argv)
+{
+	if (argc != 2 && argc != 3) {
+		usage(false);
+		return 1;
+	}
+
+	unique_ptr<container_reader> reader;
+	uint32_t offset = argc == 3 ? lexical_cast<uint32_t>(argv[2], 0) : 0;
+
+	if (container_reader::is_container(argv[1])) {
+		reader.reset(new container_reader(argv[1]));
+		if (argc != 3) {
+			offset = reader->metadata().offset;
+		}
+	}
+
+	ps_scanner scanner(offset);
+
+	if (reader) {
+		for (uint64_t pos = 0; pos < reader->size(); pos += 1024 * 1024) {
+			scanner.feed(reader->read(pos, min<uint64_t>(reader->size() - pos, 1024 * 1024)));
+		}
+	} else {
+		ifstream in(argv[1], ios::binary);
+		if (!in.good()) {
+			throw user_error("failed to open "s + argv[1] + " for reading");
+		}
+
+		string buf(1024 * 1024, '\0');
+
+		while (in.read(&buf[0], buf.size()) || in.gcount()) {
+			scanner.feed(buf.data(), in.gcount());
+		}
+	}
+
+	bool ok = true;
+
+	for (auto& img : scanner.images()) {
+		if (!img.complete || !img.crc_valid) {
+			ok = false;
+		}
+	}
+
+	if (scanner.images().empty()) {
+		logger::i() << "no images found" << endl;
+	} else {
+		print_images(scanner.images());
+	}
+
+	return ok ? 0 : 1;
+}
+
+int do_unpack(int argc, char** argv, int opts)
+{
+	if (argc != 3 && argc != 4) {
+		usage(false);
+		return 1;
+	}
+
+	if (access(argv[2], F_OK) == 0 && !(opts & opt_force)) {
+		throw user_error("output file "s + argv[2] + " exists; specify -F to overwrite");
+	}
+
+	container_reader reader(argv[1]);
+	const container_metadata& meta = reader.metadata();
+
+	// range, relative to the start of the dump
+	uint64_t offset = 0;
+	uint64_t length = reader.size();
+
+	if (argc == 4) {
+		auto tokens = split(argv[3], ',');
+		if (tokens.empty() || tokens.size() > 2) {
+			throw user_error("invalid argument '"s + argv[3] + "'");
+		}
+
+		uint32_t addr = 0, size = 0;
+		auto sub = split(tokens[0], '+');
+
+		try {
+			addr = lexical_cast<uint32_t>(tokens[0], 0);
+		} catch (const bad_lexical_cast& e) {
+			auto it = find_if(meta.partitions.begin(), meta.partitions.end(),
+					[&sub] (const container_metadata::partition& p) { return p.name == sub[0]; });
+			if (it == meta.partitions.end()) {
+				throw user_error("no such partition in " + meta.space + ": " + sub[0]);
 			}
 
-			printf("\r ");
-			progress_set(&pg, offset);
-			progress_print(&pg, stdout);
-		});
+			addr = it->offset;
+			size = it->size;
+
+			if (sub.size() == 2) {
+				uint32_t off = lexical_cast<uint32_t>(sub[1], 0);
+				addr += off;
+				size = size > off ? size - off : 0;
+			}
+		}
+
+		if (tokens.size() == 2) {
+			size = lexical_cast<uint32_t>(tokens[1], 0);
+		}
+
+		if (addr < meta.offset) {
+			throw user_error("offset 0x" + to_hex(addr) + " is not part of the dump");
+		}
+
+		offset = addr - meta.offset;
+		length = size ? size : reader.size() - min<uint64_t>(offset, reader.size());
+	}
+
+	ofstream out(argv[2], ios::binary | ios::trunc);
+
+	while (length) {
+		uint32_t n = min<uint64_t>(length, 1024 * 1024);
+		string data = reader.read(offset, n);
+		out.write(data.data(), data.size());
+		offset += n;
+		length -= n;
+	}
+
+	out.close();
+
+	if (!out) {
+		throw user_error("failed to write "s + argv[2]);
 	}
 
-	rwx->write(argv[3], in);
 	return 0;
 }
 
@@ -237,7 +1056,7 @@ int main(int argc, char** argv)
 	optind = 0;
 	opterr = 0;
 
-	while ((opt = getopt(argc, argv, "hsARFqvP:")) != -1) {
+	while ((opt = getopt(argc, argv, "hsARFqvP:L:X:O:J:M:")) != -1) {
 		switch (opt) {
 		case 's':
 			opts |= opt_safe;
@@ -261,6 +1080,25 @@ int main(int argc, char** argv)
 		case 'P':
 			profile = optarg;
 			break;
+		case 'L':
+			io::record_to(optarg);
+			break;
+		case 'X':
+			io::inject_faults(optarg);
+			break;
+		case 'O':
+			output_type = optarg;
+			break;
+		case 'M':
+			metrics_file = optarg;
+			break;
+		case 'J':
+			event_stream.reset(new ofstream(optarg, ios::app));
+			if (!event_stream->good()) {
+				logger::e() << "error: failed to open " << optarg << endl;
+				return 1;
+			}
+			break;
 		case 'h':
 		default:
 			bool help = (opt == 'h' || (optopt == '-' && argv[optind] == "help"s));
@@ -280,13 +1118,29 @@ int main(int argc, char** argv)
 	argv += optind;
 	argc -= optind;
 
+	int ret = 1;
+
 	try {
 		if (cmd == "info") {
-			return do_info(argc, argv, profile);
+			ret = do_info(argc, argv, profile);
 		} else if (cmd == "dump") {
-			return do_dump(argc, argv, opts, profile);
+			ret = do_dump(argc, argv, opts, profile);
+		} else if (cmd == "dumpall") {
+			ret = do_dumpall(argc, argv, opts, profile);
+		} else if (cmd == "store") {
+			ret = do_store(argc, argv, opts, profile);
+		} else if (cmd == "extract") {
+			ret = do_extract(argc, argv, opts);
 		} else if (cmd == "write") {
-			return do_write(argc, argv, opts, profile);
+			ret = do_write(argc, argv, opts, profile);
+		} else if (cmd == "verify") {
+			ret = do_verify(argc, argv, opts, profile);
+		} else if (cmd == "search") {
+			ret = do_search(argc, argv, opts, profile);
+		} else if (cmd == "scan") {
+			ret = do_scan(argc, argv);
+		} else if (cmd == "unpack") {
+			ret = do_unpack(argc, argv, opts);
 		} else {
 			logger::e() << "command not implemented: " << cmd << endl;
 		}
@@ -304,5 +1158,18 @@ int main(int argc, char** argv)
 		handle_exception(e);
 	}
 
-	return 1;
+	if (logger::loglevel() <= logger::verbose) {
+		logger::v() << endl;
+		metrics::print_summary(logger::v());
+	}
+
+	if (!metrics_file.empty()) {
+		ofstream out(metrics_file);
+		metrics::write_json(out);
+		if (!out.good()) {
+			logger::e() << "error: failed to write " << metrics_file << endl;
+		}
+	}
+
+	return ret;
 }
@@ -72,10 +72,13 @@ bool cm_flash_parse_values(const char *line, char *buf16, bool quiet);
 struct progress {
 	unsigned min;
 	unsigned max;
-	time_t beg;
-	time_t last;
+	/* monotonic time in milliseconds */
+	uint64_t beg;
+	uint64_t last;
+	uint64_t last_print;
 	unsigned cur;
 	unsigned tmp;
+	/* exponentially weighted moving average */
 	unsigned speed_now;
 	unsigned speed_avg;
 	float percentage;
@@ -87,6 +90,12 @@ void progress_init(struct progress *p, unsigned min, unsigned len);
 void progress_add(struct progress *p, unsigned n);
 void progress_set(struct progress *p, unsigned n);
 void progress_print(struct progress *p, FILE *fp);
+/* true if at least interval_ms have passed since this last returned true,
+ * or if the operation is complete. */
+bool progress_print_due(struct progress *p, unsigned interval_ms);
+/* estimated remaining time, in milliseconds */
+uint64_t progress_eta_millis(const struct progress *p);
+uint64_t progress_millis(void);
 
 struct code_cfg {
 	struct bcm2_profile *profile;
@@ -0,0 +1,340 @@
+/**
+ * bcm2-utils
+ * Copyright (C) 2016 Joseph Lehner <joseph.c.lehner@gmail.com>
+ *
+ * bcm2-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bcm2-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bcm2-utils.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <ctime>
+#include "metrics.h"
+#include "util.h"
+using namespace bcm2dump;
+using namespace std;
+
+#ifndef VERSION
+#define VERSION "v(unknown)"
+#endif
+
+namespace {
+
+// see the description of the recording format in io.cc
+const string rec_magic = "BCM2REC\x01";
+
+const char rec_in = 'i';
+const char rec_write = 'w';
+const char rec_writeln = 'l';
+const char rec_timeout = 't';
+const char rec_wait = 'p';
+const char rec_skip = 's';
+
+struct event
+{
+	char type;
+	// time since the start of the recording, in microseconds
+	uint64_t time;
+	// time since the previous event, in microseconds
+	uint64_t delta;
+	string data;
+};
+
+struct command
+{
+	string text;
+	uint64_t time;
+	// time until the first response, or 0 if there was none
+	uint64_t rtt = 0;
+	// time until the next command
+	uint64_t duration = 0;
+	uint64_t bytes = 0;
+};
+
+void usage()
+{
+	ostream& os = logger::i();
+
+	os << "Usage: bcm2trace [<options>] <recording>" << endl;
+	os << endl;
+	os << "Analyze a session recorded using bcm2dump -L <recording>." << endl;
+	os << endl;
+	os << "Options:" << endl;
+	os << "  -i <seconds>     Throughput interval (default: 1)" << endl;
+	os << "  -n <count>       Number of slowest commands to list (default: 10)" << endl;
+	os << endl;
+	os << "bcm2trace " << VERSION << " Copyright (C) 2016 Joseph C. Lehner" << endl;
+	os << "Licensed under the GNU GPLv3; source code is available at" << endl;
+	os << "https://github.com/jclehner/bcm2utils" << endl;
+	os << endl;
+}
+
+uint32_t extract_u32(const string& data)
+{
+	return data.size() >= 4 ? ntohl(extract<uint32_t>(data, 0)) : 0;
+}
+
+string seconds(uint64_t usecs)
+{
+	ostringstream ostr;
+	ostr << fixed << setprecision(3) << (usecs / 1000000.0) << " s";
+	return ostr.str();
+}
+
+string millis(uint64_t usecs)
+{
+	ostringstream ostr;
+	ostr << fixed << setprecision(1) << (usecs / 1000.0) << " ms";
+	return ostr.str();
+}
+
+string percent(uint64_t part, uint64_t total)
+{
+	ostringstream ostr;
+	ostr << fixed << setprecision(1) << (total ? (100.0 * part / total) : 0.0) << "%";
+	return ostr.str();
+}
+
+void print_histogram(const string& name, const metrics::histogram& h)
+{
+	cout << "  " << left << setw(24) << name << right;
+
+	if (!h.count) {
+		cout << "-" << endl;
+		return;
+	}
+
+	cout << setw(8) << h.count << " x, avg " << millis(h.sum / h.count) << ", p50 "
+			<< millis(h.percentile(0.5)) << ", p99 " << millis(h.percentile(0.99))
+			<< ", max " << millis(h.max) << endl;
+}
+
+vector<event> read_recording(const string& filename, uint64_t& start)
+{
+	ifstream in(filename, ios::binary);
+	if (!in.good()) {
+		throw user_error("failed to open " + filename);
+	}
+
+	string magic(rec_magic.size(), '\0');
+	uint32_t buf[2];
+
+	if (!in.read(&magic[0], magic.size()) || magic != rec_magic
+			|| !in.read(reinterpret_cast<char*>(buf), sizeof(buf))) {
+		throw user_error(filename + ": not a session recording");
+	}
+
+	start = (uint64_t(ntohl(buf[0])) << 32) | ntohl(buf[1]);
+
+	vector<event> ret;
+	uint64_t time = 0;
+	uint64_t skipped = 0;
+	event e;
+	uint32_t delta;
+	uint16_t length;
+
+	while (in.get(e.type) && in.read(reinterpret_cast<char*>(&delta), 4)
+			&& in.read(reinterpret_cast<char*>(&length), 2)) {
+		e.delta = ntohl(delta) + skipped;
+		e.data.resize(ntohs(length));
+		if (!in.read(&e.data[0], e.data.size())) {
+			logger::w() << filename << ": recording is truncated" << endl;
+			break;
+		}
+
+		// fillers are merged into the next event's delta
+		if (e.type == rec_skip) {
+			skipped = e.delta;
+			continue;
+		}
+
+		skipped = 0;
+		time += e.delta;
+		e.time = time;
+		ret.push_back(e);
+	}
+
+	return ret;
+}
+
+int analyze(const string& filename, unsigned interval, unsigned count)
+{
+	uint64_t start;
+	vector<event> events = read_recording(filename, start);
+	if (events.empty()) {
+		throw user_error(filename + ": recording is empty");
+	}
+
+	vector<command> commands;
+	metrics::histogram rtt, duration, gaps;
+	uint64_t bytes_in = 0, bytes_out = 0, lines = 0;
+	uint64_t waiting = 0, timeouts = 0, timeout_time = 0;
+	uint64_t interval_us = interval * 1000000ULL;
+	vector<uint64_t> timeline(events.back().time / interval_us + 1);
+	char prev = 0;
+
+	for (auto& e : events) {
+		if (e.type == rec_in) {
+			bytes_in += e.data.size();
+			timeline[e.time / interval_us] += e.data.size();
+
+			if (!e.data.empty() && e.data.back() == '\n') {
+				++lines;
+			}
+
+			if (prev == rec_in) {
+				gaps.add(e.delta);
+			}
+
+			if (!commands.empty()) {
+				command& c = commands.back();
+				if (!c.rtt) {
+					c.rtt = max<uint64_t>(e.time - c.time, 1);
+				}
+				c.bytes += e.data.size();
+			}
+		} else if (e.type == rec_write || e.type == rec_writeln) {
+			bytes_out += e.data.size() + (e.type == rec_writeln ? 2 : 0);
+
+			if (!commands.empty()) {
+				commands.back().duration = e.time - commands.back().time;
+			}
+
+			command c;
+			c.text = trim(e.data);
+			c.time = e.time;
+			commands.push_back(c);
+		} else if (e.type == rec_wait) {
+			waiting += extract_u32(e.data);
+		} else if (e.type == rec_timeout) {
+			// the delta is the time spent waiting, plus whatever
+			// happened since the previous event
+			++timeouts;
+			timeout_time += min<uint64_t>(e.delta, extract_u32(e.data) * 1000ULL);
+		}
+
+		if (e.type != rec_wait) {
+			prev = e.type;
+		}
+	}
+
+	if (!commands.empty()) {
+		commands.back().duration = events.back().time - commands.back().time;
+	}
+
+	for (auto& c : commands) {
+		if (c.rtt) {
+			rtt.add(c.rtt);
+		}
+		duration.add(c.duration);
+	}
+
+	uint64_t total = events.back().time;
+	uint64_t idle = waiting + timeout_time;
+
+	time_t started = start / 1000000;
+	char buf[64];
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&started));
+
+	cout << filename << ": recorded " << buf << ", " << seconds(total) << endl;
+	cout << endl;
+	cout << "traffic:" << endl;
+	cout << "  " << left << setw(24) << "bytes in" << right << setw(8) << bytes_in
+			<< " (" << (total ? bytes_in * 1000000 / total : 0) << " b/s)" << endl;
+	cout << "  " << left << setw(24) << "bytes out" << right << setw(8) << bytes_out << endl;
+	cout << "  " << left << setw(24) << "lines in" << right << setw(8) << lines << endl;
+	cout << "  " << left << setw(24) << "commands" << right << setw(8) << commands.size() << endl;
+	cout << endl;
+	cout << "time:" << endl;
+	cout << "  " << left << setw(24) << "waiting for data" << right << setw(12) << seconds(waiting)
+			<< " (" << percent(waiting, total) << ")" << endl;
+	cout << "  " << left << setw(24) << "timeouts" << right << setw(12) << seconds(timeout_time)
+			<< " (" << percent(timeout_time, total) << ", " << timeouts << " x)" << endl;
+	cout << "  " << left << setw(24) << "other (processing)" << right << setw(12)
+			<< seconds(total > idle ? total - idle : 0) << " (" << percent(total > idle ? total - idle : 0, total)
+			<< ")" << endl;
+	cout << endl;
+	cout << "latency:" << endl;
+	print_histogram("round trip", rtt);
+	print_histogram("command duration", duration);
+	print_histogram("inter-line gap", gaps);
+
+	if (count && !commands.empty()) {
+		vector<command> slowest(commands);
+		sort(slowest.begin(), slowest.end(), [] (const command& a, const command& b) {
+			return a.duration > b.duration;
+		});
+
+		cout << endl << "slowest commands:" << endl;
+
+		for (size_t i = 0; i < min<size_t>(count, slowest.size()); ++i) {
+			const command& c = slowest[i];
+			cout << "  " << setw(10) << seconds(c.time) << "  " << setw(10) << millis(c.duration)
+					<< "  rtt " << setw(9) << (c.rtt ? millis(c.rtt) : "-") << "  " << setw(8) << c.bytes
+					<< " b  '" << c.text << "'" << endl;
+		}
+	}
+
+	cout << endl << "throughput:" << endl;
+
+	for (size_t i = 0; i < timeline.size(); ++i) {
+		cout << "  " << setw(10) << seconds(i * interval_us) << "  " << setw(10)
+				<< (timeline[i] / interval) << " b/s" << endl;
+	}
+
+	return 0;
+}
+}
+
+int main(int argc, char** argv)
+{
+	unsigned interval = 1;
+	unsigned count = 10;
+	int opt;
+
+	try {
+		while ((opt = getopt(argc, argv, "hi:n:")) != -1) {
+			switch (opt) {
+			case 'i':
+				interval = lexical_cast<unsigned>(optarg);
+				if (!interval) {
+					throw user_error("invalid interval "s + optarg);
+				}
+				break;
+			case 'n':
+				count = lexical_cast<unsigned>(optarg);
+				break;
+			case 'h':
+			default:
+				usage();
+				return opt == 'h' ? 0 : 1;
+			}
+		}
+
+		if (optind + 1 != argc) {
+			usage();
+			return 1;
+		}
+
+		return analyze(argv[optind], interval, count);
+	} catch (const exception& e) {
+		logger::e() << "error: " << e.what() << endl;
+	}
+
+	return 1;
+}
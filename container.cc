@@ -0,0 +1,324 @@
+/**
+ * bcm2-utils
+ * Copyright (C) 2016 Joseph Lehner <joseph.c.lehner@gmail.com>
+ *
+ * bcm2-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bcm2-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bcm2-utils.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <zlib.h>
+#include <cstring>
+#include "container.h"
+#include "util.h"
+using namespace std;
+
+namespace bcm2dump {
+namespace {
+
+const char header_magic[] = "BCM2DUMP";
+const char footer_magic[] = "BCM2END";
+const uint32_t container_version = 1;
+const size_t header_size = 16;
+const size_t footer_size = 40;
+const size_t index_entry_size = 20;
+
+void append32(string& buf, uint32_t n)
+{
+	n = htonl(n);
+	buf.append(reinterpret_cast<const char*>(&n), sizeof(n));
+}
+
+void append64(string& buf, uint64_t n)
+{
+	append32(buf, n >> 32);
+	append32(buf, n & 0xffffffff);
+}
+
+uint32_t extract32(const string& buf, size_t offset)
+{
+	return ntohl(extract<uint32_t>(buf, offset));
+}
+
+uint64_t extract64(const string& buf, size_t offset)
+{
+	return (uint64_t(extract32(buf, offset)) << 32) | extract32(buf, offset + 4);
+}
+}
+
+string container_metadata::to_string() const
+{
+	ostringstream ostr;
+	ostr << "version " << version << endl;
+	ostr << "profile " << profile << endl;
+	ostr << "space " << space << endl;
+	ostr << "offset 0x" << to_hex(offset) << endl;
+
+	for (auto& p : partitions) {
+		ostr << "partition 0x" << to_hex(p.offset) << " " << p.size << " " << p.name << endl;
+	}
+
+	for (auto& i : images) {
+		ostr << "image 0x" << to_hex(i.offset) << " " << i.length << " 0x" << to_hex(i.signature)
+				<< " " << (i.crc_valid ? "ok" : "bad") << " " << i.filename << endl;
+	}
+
+	return ostr.str();
+}
+
+container_metadata container_metadata::parse(const string& str)
+{
+	container_metadata ret;
+
+	for (auto line : split(str, '\n', false)) {
+		auto tokens = split(line, ' ', true, 2);
+		if (tokens.size() != 2) {
+			throw runtime_error("invalid metadata line: " + line);
+		}
+
+		const string& key = tokens[0];
+		const string& val = tokens[1];
+
+		if (key == "version") {
+			ret.version = val;
+		} else if (key == "profile") {
+			ret.profile = val;
+		} else if (key == "space") {
+			ret.space = val;
+		} else if (key == "offset") {
+			ret.offset = lexical_cast<uint32_t>(val, 0);
+		} else if (key == "partition") {
+			auto t = split(val, ' ', true, 3);
+			if (t.size() != 3) {
+				throw runtime_error("invalid metadata line: " + line);
+			}
+			ret.partitions.push_back({ t[2], lexical_cast<uint32_t>(t[0], 0), lexical_cast<uint32_t>(t[1]) });
+		} else if (key == "image") {
+			auto t = split(val, ' ', true, 5);
+			if (t.size() != 5) {
+				throw runtime_error("invalid metadata line: " + line);
+			}
+			ret.images.push_back({ lexical_cast<uint32_t>(t[0], 0), lexical_cast<uint32_t>(t[1]),
+					lexical_cast<uint16_t>(t[2], 0), t[3] == "ok", t[4] });
+		}
+		// unknown keys are ignored, to allow for additions
+	}
+
+	return ret;
+}
+
+container_writer::container_writer(const string& filename, uint32_t frame_size)
+: m_filename(filename), m_out(filename, ios::binary | ios::trunc), m_frame_size(frame_size)
+{
+	if (!m_out.good()) {
+		throw user_error("failed to open " + filename + " for writing");
+	}
+
+	m_out.exceptions(ios::failbit | ios::badbit);
+
+	string hdr(header_magic, 8);
+	append32(hdr, container_version);
+	append32(hdr, m_frame_size);
+	m_out.write(hdr.data(), hdr.size());
+	m_file_pos = hdr.size();
+}
+
+void container_writer::write(uint64_t offset, const char* buf, size_t length)
+{
+	if (offset != m_pos + m_buf.size()) {
+		throw runtime_error("non-sequential write to container");
+	}
+
+	while (length) {
+		size_t n = min<size_t>(length, m_frame_size - m_buf.size());
+		m_buf.append(buf, n);
+		buf += n;
+		length -= n;
+
+		if (m_buf.size() == m_frame_size) {
+			write_frame();
+		}
+	}
+}
+
+void container_writer::finish()
+{
+	if (!m_buf.empty()) {
+		write_frame();
+	}
+
+	m_out.flush();
+}
+
+void container_writer::close(const container_metadata& meta)
+{
+	finish();
+
+	string meta_str = meta.to_string();
+	uint64_t meta_offset = m_file_pos;
+	m_out.write(meta_str.data(), meta_str.size());
+	m_file_pos += meta_str.size();
+
+	string index;
+	for (auto& f : m_frames) {
+		append64(index, f.offset);
+		append32(index, f.csize);
+		append32(index, f.size);
+		append32(index, f.crc);
+	}
+
+	uint64_t index_offset = m_file_pos;
+	m_out.write(index.data(), index.size());
+
+	string footer;
+	append64(footer, meta_offset);
+	append32(footer, meta_str.size());
+	append64(footer, index_offset);
+	append32(footer, m_frames.size());
+	append64(footer, m_pos);
+	footer.append(footer_magic, 8);
+	m_out.write(footer.data(), footer.size());
+
+	m_out.close();
+}
+
+void container_writer::write_frame()
+{
+	uLongf csize = compressBound(m_buf.size());
+	m_cbuf.resize(csize);
+
+	int err = compress2(reinterpret_cast<Bytef*>(&m_cbuf[0]), &csize,
+			reinterpret_cast<const Bytef*>(m_buf.data()), m_buf.size(), Z_DEFAULT_COMPRESSION);
+	if (err != Z_OK) {
+		throw runtime_error("failed to compress frame: " + string(zError(err)));
+	}
+
+	m_out.write(m_cbuf.data(), csize);
+	m_frames.push_back({ m_file_pos, uint32_t(csize), uint32_t(m_buf.size()), crc32_ieee(m_buf) });
+
+	m_file_pos += csize;
+	m_pos += m_buf.size();
+	m_buf.clear();
+}
+
+container_reader::container_reader(const string& filename)
+: m_filename(filename), m_in(filename, ios::binary)
+{
+	if (!m_in.good()) {
+		throw user_error("failed to open " + filename + " for reading");
+	}
+
+	m_in.exceptions(ios::failbit | ios::badbit);
+
+	string hdr(header_size, '\0');
+	m_in.read(&hdr[0], hdr.size());
+	if (hdr.compare(0, 8, header_magic) || extract32(hdr, 8) != container_version) {
+		throw user_error(filename + ": not a bcm2dump container");
+	}
+
+	m_frame_size = extract32(hdr, 12);
+
+	string footer(footer_size, '\0');
+	m_in.seekg(-streamoff(footer_size), ios::end);
+	m_in.read(&footer[0], footer.size());
+	if (footer.compare(32, 8, string(footer_magic, 8))) {
+		throw user_error(filename + ": incomplete container");
+	}
+
+	uint64_t meta_offset = extract64(footer, 0);
+	uint32_t meta_size = extract32(footer, 8);
+	uint64_t index_offset = extract64(footer, 12);
+	uint32_t count = extract32(footer, 20);
+	m_size = extract64(footer, 24);
+
+	string meta(meta_size, '\0');
+	m_in.seekg(meta_offset);
+	m_in.read(&meta[0], meta.size());
+	m_meta = container_metadata::parse(meta);
+
+	string index(count * index_entry_size, '\0');
+	m_in.seekg(index_offset);
+	m_in.read(&index[0], index.size());
+
+	uint64_t total = 0;
+
+	for (uint32_t i = 0; i < count; ++i) {
+		size_t pos = i * index_entry_size;
+		frame f = { extract64(index, pos), extract32(index, pos + 8),
+				extract32(index, pos + 12), extract32(index, pos + 16) };
+		// all frames but the last one must be full
+		if ((f.size != m_frame_size && (i + 1) != count) || f.size > m_frame_size) {
+			throw runtime_error(filename + ": invalid frame size in index");
+		}
+		total += f.size;
+		m_frames.push_back(f);
+	}
+
+	if (total != m_size) {
+		throw runtime_error(filename + ": size mismatch in index");
+	}
+}
+
+string container_reader::read(uint64_t offset, size_t length)
+{
+	if (offset > m_size || length > (m_size - offset)) {
+		throw user_error("range exceeds dump size");
+	}
+
+	string ret;
+	ret.reserve(length);
+
+	while (length) {
+		const string& f = load_frame(offset / m_frame_size);
+		size_t pos = offset % m_frame_size;
+		size_t n = min(length, f.size() - pos);
+		ret.append(f, pos, n);
+		offset += n;
+		length -= n;
+	}
+
+	return ret;
+}
+
+bool container_reader::is_container(const string& filename)
+{
+	ifstream in(filename, ios::binary);
+	char magic[8];
+	return in.read(magic, sizeof(magic)) && !memcmp(magic, header_magic, sizeof(magic));
+}
+
+const string& container_reader::load_frame(size_t index)
+{
+	if (index == m_cached) {
+		return m_cache;
+	}
+
+	const frame& f = m_frames.at(index);
+	string cbuf(f.csize, '\0');
+	m_in.seekg(f.offset);
+	m_in.read(&cbuf[0], cbuf.size());
+
+	m_cache.resize(f.size);
+	uLongf size = f.size;
+
+	int err = uncompress(reinterpret_cast<Bytef*>(&m_cache[0]), &size,
+			reinterpret_cast<const Bytef*>(cbuf.data()), cbuf.size());
+	if (err != Z_OK || size != f.size || crc32_ieee(m_cache) != f.crc) {
+		m_cached = -1;
+		throw runtime_error(m_filename + ": corrupted frame at offset " + std::to_string(f.offset));
+	}
+
+	m_cached = index;
+	return m_cache;
+}
+}
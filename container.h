@@ -0,0 +1,152 @@
+/**
+ * bcm2-utils
+ * Copyright (C) 2016 Joseph Lehner <joseph.c.lehner@gmail.com>
+ *
+ * bcm2-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bcm2-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bcm2-utils.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef BCM2DUMP_CONTAINER_H
+#define BCM2DUMP_CONTAINER_H
+#include <fstream>
+#include <string>
+#include <vector>
+#include "sink.h"
+
+namespace bcm2dump {
+
+// compressed dump container. the data is split into frames of a fixed
+// size, each of which is compressed separately, so that any range can
+// be read without decompressing the whole file.
+//
+// layout (all numbers big endian):
+//
+// header:   "BCM2DUMP", u32 version, u32 frame size
+// frames:   zlib streams
+// metadata: text, one "<key> <value>" per line
+// index:    u64 offset, u32 compressed size, u32 size, u32 crc32 (per frame)
+// footer:   u64 metadata offset, u32 metadata size, u64 index offset,
+//           u32 frame count, u64 size, "BCM2END\0"
+struct container_metadata
+{
+	struct partition
+	{
+		std::string name;
+		uint32_t offset;
+		uint32_t size;
+	};
+
+	struct image
+	{
+		uint32_t offset;
+		uint32_t length;
+		uint16_t signature;
+		bool crc_valid;
+		std::string filename;
+	};
+
+	std::string version;
+	std::string profile;
+	std::string space;
+	// address of the first byte of the dump
+	uint32_t offset = 0;
+	std::vector<partition> partitions;
+	// ProgramStore images found in the dump
+	std::vector<image> images;
+
+	std::string to_string() const;
+	static container_metadata parse(const std::string& str);
+};
+
+class container_writer : public sink
+{
+	public:
+	container_writer(const std::string& filename, uint32_t frame_size = 256 * 1024);
+
+	virtual uint64_t size() override
+	{ return 0; }
+
+	virtual void write(uint64_t offset, const char* buf, size_t length) override;
+	// compresses the last (possibly incomplete) frame
+	virtual void finish() override;
+
+	virtual bool positional() const override
+	{ return false; }
+
+	// writes metadata, index and footer. the container is not valid
+	// until this has been called.
+	void close(const container_metadata& meta);
+
+	private:
+	struct frame
+	{
+		uint64_t offset;
+		uint32_t csize;
+		uint32_t size;
+		uint32_t crc;
+	};
+
+	void write_frame();
+
+	std::string m_filename;
+	std::ofstream m_out;
+	uint32_t m_frame_size;
+	uint64_t m_pos = 0;
+	uint64_t m_file_pos = 0;
+	std::string m_buf;
+	std::string m_cbuf;
+	std::vector<frame> m_frames;
+};
+
+class container_reader
+{
+	public:
+	container_reader(const std::string& filename);
+
+	const container_metadata& metadata() const
+	{ return m_meta; }
+
+	// size of the uncompressed dump
+	uint64_t size() const
+	{ return m_size; }
+
+	// reads <length> bytes, starting at <offset> bytes into the dump
+	std::string read(uint64_t offset, size_t length);
+
+	static bool is_container(const std::string& filename);
+
+	private:
+	struct frame
+	{
+		uint64_t offset;
+		uint32_t csize;
+		uint32_t size;
+		uint32_t crc;
+	};
+
+	const std::string& load_frame(size_t index);
+
+	std::string m_filename;
+	std::ifstream m_in;
+	uint32_t m_frame_size;
+	uint64_t m_size;
+	std::vector<frame> m_frames;
+	container_metadata m_meta;
+	// most recently used frame
+	size_t m_cached = -1;
+	std::string m_cache;
+};
+}
+
+#endif
@@ -0,0 +1,287 @@
+/**
+ * bcm2-utils
+ * Copyright (C) 2016 Joseph Lehner <joseph.c.lehner@gmail.com>
+ *
+ * bcm2-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bcm2-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bcm2-utils.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cstring>
+#include "crc.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BCM2_CRC32_PCLMUL
+#elif defined(__aarch64__) && defined(__linux__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define BCM2_CRC32_ARMV8
+#endif
+
+using namespace std;
+
+namespace bcm2dump {
+namespace {
+
+// slice-by-8 lookup tables. table[k][b] is the crc of byte b,
+// followed by k zero bytes.
+struct crc_tables
+{
+	crc_tables();
+
+	uint16_t crc16[8][256];
+	uint32_t crc32[8][256];
+};
+
+crc_tables::crc_tables()
+{
+	for (unsigned b = 0; b < 256; ++b) {
+		uint16_t c16 = b << 8;
+		uint32_t c32 = b;
+
+		for (unsigned i = 0; i < 8; ++i) {
+			c16 = (c16 & 0x8000) ? ((c16 << 1) ^ 0x1021) : (c16 << 1);
+			c32 = (c32 & 1) ? ((c32 >> 1) ^ 0xedb88320) : (c32 >> 1);
+		}
+
+		crc16[0][b] = c16;
+		crc32[0][b] = c32;
+	}
+
+	for (unsigned k = 1; k < 8; ++k) {
+		for (unsigned b = 0; b < 256; ++b) {
+			uint16_t c16 = crc16[k - 1][b];
+			crc16[k][b] = (c16 << 8) ^ crc16[0][c16 >> 8];
+			uint32_t c32 = crc32[k - 1][b];
+			crc32[k][b] = (c32 >> 8) ^ crc32[0][c32 & 0xff];
+		}
+	}
+}
+
+const crc_tables& tables()
+{
+	static const crc_tables t;
+	return t;
+}
+
+inline uint32_t load_le32(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24);
+}
+
+uint16_t crc16_slice8(uint16_t crc, const uint8_t* p, size_t size)
+{
+	auto& t = tables().crc16;
+
+	for (; size >= 8; p += 8, size -= 8) {
+		crc = t[7][(crc >> 8) ^ p[0]] ^ t[6][(crc & 0xff) ^ p[1]] ^ t[5][p[2]] ^ t[4][p[3]]
+				^ t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+	}
+
+	while (size--) {
+		crc = (crc << 8) ^ t[0][(crc >> 8) ^ *p++];
+	}
+
+	return crc;
+}
+
+uint32_t crc32_slice8(uint32_t crc, const uint8_t* p, size_t size)
+{
+	auto& t = tables().crc32;
+
+	for (; size >= 8; p += 8, size -= 8) {
+		uint32_t a = crc ^ load_le32(p);
+		uint32_t b = load_le32(p + 4);
+
+		crc = t[7][a & 0xff] ^ t[6][(a >> 8) & 0xff] ^ t[5][(a >> 16) & 0xff] ^ t[4][a >> 24]
+				^ t[3][b & 0xff] ^ t[2][(b >> 8) & 0xff] ^ t[1][(b >> 16) & 0xff] ^ t[0][b >> 24];
+	}
+
+	while (size--) {
+		crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+	}
+
+	return crc;
+}
+
+#ifdef BCM2_CRC32_PCLMUL
+// folding implementation, as described in Intel's "Fast CRC Computation
+// for Generic Polynomials Using PCLMULQDQ Instruction". constants are
+// for the bit-reflected polynomial.
+__attribute__((target("pclmul,sse4.1")))
+uint32_t crc32_pclmul_fold(uint32_t crc, const uint8_t* p, size_t size)
+{
+	alignas(16) static const uint64_t k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+	alignas(16) static const uint64_t k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+	alignas(16) static const uint64_t k5k0[] = { 0x0163cd6124, 0x0000000000 };
+	alignas(16) static const uint64_t poly[] = { 0x01db710641, 0x01f7011641 };
+
+	auto load = [] (const uint8_t* p) {
+		return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+	};
+
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+	// size is at least 64, and a multiple of 16
+	x1 = _mm_xor_si128(load(p), _mm_cvtsi32_si128(crc));
+	x2 = load(p + 0x10);
+	x3 = load(p + 0x20);
+	x4 = load(p + 0x30);
+	x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k1k2));
+
+	for (p += 64, size -= 64; size >= 64; p += 64, size -= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), load(p));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), load(p + 0x10));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), load(p + 0x20));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), load(p + 0x30));
+	}
+
+	// fold 4 x 128 bits into 128 bits
+	x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k3k4));
+
+	for (__m128i x : { x2, x3, x4 }) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x), x5);
+	}
+
+	for (; size >= 16; p += 16, size -= 16) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, load(p)), x5);
+	}
+
+	// fold 128 bits into 64 bits
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+	x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(k5k0));
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// barrett reduction to 32 bits
+	x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(poly));
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return _mm_extract_epi32(x1, 1);
+}
+
+uint32_t crc32_pclmul(uint32_t crc, const uint8_t* p, size_t size)
+{
+	if (size >= 64) {
+		size_t n = size & ~size_t(15);
+		crc = crc32_pclmul_fold(crc, p, n);
+		p += n;
+		size -= n;
+	}
+
+	return crc32_slice8(crc, p, size);
+}
+
+bool have_pclmul()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+}
+#endif
+
+#ifdef BCM2_CRC32_ARMV8
+__attribute__((target("+crc")))
+uint32_t crc32_armv8(uint32_t crc, const uint8_t* p, size_t size)
+{
+	for (; size && (reinterpret_cast<uintptr_t>(p) & 7); --size) {
+		crc = __crc32b(crc, *p++);
+	}
+
+	for (; size >= 8; p += 8, size -= 8) {
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		crc = __crc32d(crc, v);
+	}
+
+	while (size--) {
+		crc = __crc32b(crc, *p++);
+	}
+
+	return crc;
+}
+
+bool have_armv8_crc()
+{
+	return getauxval(AT_HWCAP) & HWCAP_CRC32;
+}
+#endif
+
+typedef uint32_t (*crc32_func)(uint32_t, const uint8_t*, size_t);
+
+struct crc32_impl
+{
+	const char* name;
+	crc32_func func;
+};
+
+const crc32_impl& crc32_select()
+{
+	static const crc32_impl impl = [] () -> crc32_impl {
+#if defined(BCM2_CRC32_PCLMUL)
+		if (have_pclmul()) {
+			return { "pclmul", &crc32_pclmul };
+		}
+#elif defined(BCM2_CRC32_ARMV8)
+		if (have_armv8_crc()) {
+			return { "armv8", &crc32_armv8 };
+		}
+#endif
+		return { "slice8", &crc32_slice8 };
+	}();
+
+	return impl;
+}
+}
+
+crc16_stream& crc16_stream::update(const void* buf, size_t size)
+{
+	m_crc = crc16_slice8(m_crc, reinterpret_cast<const uint8_t*>(buf), size);
+	return *this;
+}
+
+crc32_stream& crc32_stream::update(const void* buf, size_t size)
+{
+	m_crc = crc32_select().func(m_crc, reinterpret_cast<const uint8_t*>(buf), size);
+	return *this;
+}
+
+const char* crc32_stream::impl()
+{
+	return crc32_select().name;
+}
+}
@@ -0,0 +1,82 @@
+/**
+ * bcm2-utils
+ * Copyright (C) 2016 Joseph Lehner <joseph.c.lehner@gmail.com>
+ *
+ * bcm2-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bcm2-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bcm2-utils.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef BCM2UTILS_CRC_H
+#define BCM2UTILS_CRC_H
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace bcm2dump {
+
+// CRC-16/CCITT, as used by ProgramStore headers and the dumpcode
+// checksum (polynomial 0x1021, MSB first, initial value 0xffff, no
+// final xor).
+class crc16_stream
+{
+	public:
+	crc16_stream(uint16_t init = 0xffff) : m_crc(init) {}
+
+	crc16_stream& update(const void* buf, size_t size);
+	crc16_stream& update(const std::string& buf)
+	{ return update(buf.data(), buf.size()); }
+
+	uint16_t value() const
+	{ return m_crc; }
+
+	private:
+	uint16_t m_crc;
+};
+
+// CRC-32 (IEEE 802.3), as used by zlib, ProgramStore images and
+// permnv/dynnv (polynomial 0x04c11db7, reflected, initial value and
+// final xor 0xffffffff).
+class crc32_stream
+{
+	public:
+	crc32_stream() : m_crc(0xffffffff) {}
+
+	crc32_stream& update(const void* buf, size_t size);
+	crc32_stream& update(const std::string& buf)
+	{ return update(buf.data(), buf.size()); }
+
+	uint32_t value() const
+	{ return m_crc ^ 0xffffffff; }
+
+	// name of the implementation that is used on this machine
+	static const char* impl();
+
+	private:
+	uint32_t m_crc;
+};
+
+inline uint16_t crc16_ccitt(const void* buf, size_t size)
+{ return crc16_stream().update(buf, size).value(); }
+
+inline uint16_t crc16_ccitt(const std::string& buf)
+{ return crc16_ccitt(buf.data(), buf.size()); }
+
+inline uint32_t crc32_ieee(const void* buf, size_t size)
+{ return crc32_stream().update(buf, size).value(); }
+
+inline uint32_t crc32_ieee(const std::string& buf)
+{ return crc32_ieee(buf.data(), buf.size()); }
+}
+
+#endif
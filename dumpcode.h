@@ -207,6 +207,390 @@ _DEF_LABEL(L_OUT),
 		_WORD(0)
 };
 
+#define L_CRC_LOOP_PATCH  ASM_LABEL(0)
+#define L_CRC_PATCH_DONE  ASM_LABEL(1)
+#define L_CRC_READ_FLASH  ASM_LABEL(2)
+#define L_CRC_START       ASM_LABEL(3)
+#define L_CRC_LOOP_BLOCK  ASM_LABEL(4)
+#define L_CRC_LOOP_BYTES  ASM_LABEL(5)
+#define L_CRC_LOOP_BITS   ASM_LABEL(6)
+#define L_CRC_OUT         ASM_LABEL(7)
+
+// prints the crc32 of each <chunk size> block of the requested
+// region on a line of its own. uses the same parameter layout
+// as dumpcode, but processes the whole region in one go.
+uint32_t crccode[] = {
+		_WORD(CODE_MAGIC),
+		// ":%x"
+		_WORD(0x3a257800),
+		// "\r\n"
+		_WORD(0x0d0a0000),
+		_WORD(0), // flags
+		_WORD(0), // dump offset (unused)
+		_WORD(0), // buffer
+		_WORD(0), // offset
+		_WORD(0), // length
+		_WORD(0), // block size
+		_WORD(0), // printf
+		_WORD(0), // <flash read function>
+		_WORD(0), // <patch offset 1>
+		_WORD(0), // <patch word 1>
+		_WORD(0), // <patch offset 2>
+		_WORD(0), // <patch word 2>
+		_WORD(0), // <patch offset 3>
+		_WORD(0), // <patch word 3>
+		_WORD(0), // <patch offset 4>
+		_WORD(0), // <patch word 4>
+		// main:
+		ADDIU(SP, SP, -0x1c),
+		SW(RA, 0x00, SP),
+		SW(S7, 0x04, SP),
+		SW(S4, 0x08, SP),
+		SW(S3, 0x0c, SP),
+		SW(S2, 0x10, SP),
+		SW(S1, 0x14, SP),
+		SW(S0, 0x18, SP),
+		// branch to next instruction
+		BAL(1),
+		// delay slot: address mask
+		LUI(T0, 0xffff),
+		// store ra & 0xffff0000
+		AND(S7, RA, T0),
+		// buffer
+		LW(S0, 0x14, S7),
+		// offset
+		LW(S1, 0x18, S7),
+		// length
+		LW(S2, 0x1c, S7),
+		// bail out if length is zero
+		BEQZ(S2, L_CRC_OUT),
+		// delay slot: flash read function
+		LW(S4, 0x28, S7),
+		// maximum of 4 words can be patched
+		ORI(T0, ZERO, 4),
+		// pointer to first patch blob
+		ADDIU(T1, S7, 0x2c),
+
+_DEF_LABEL(L_CRC_LOOP_PATCH),
+		// load patch offset
+		LW(T2, 0, T1),
+		// break if patch offset is zero
+		BEQZ(T2, L_CRC_PATCH_DONE),
+		// delay slot: load patch word
+		LW(T3, 4, T1),
+		// patch word at t1
+		SW(T3, 0, T2),
+		// decrement counter
+		ADDIU(T0, T0, -1),
+		// loop until we've reached the end
+		BGTZ(T0, L_CRC_LOOP_PATCH),
+		// delay slot: set pointer to next patch blob
+		ADDIU(T1, T1, 8),
+
+_DEF_LABEL(L_CRC_PATCH_DONE),
+		// if S4 is null, we're reading RAM
+		BNEZ(S4, L_CRC_READ_FLASH),
+		// delay slot: load flags
+		LW(V0, 0x0c, S7),
+		B(L_CRC_START),
+		// delay slot: use memory offset as buffer
+		MOVE(S0, S1),
+
+_DEF_LABEL(L_CRC_READ_FLASH),
+		// set t0 if read function is (buffer, offset, length)
+		ANDI(T0, V0, CODE_DUMP_PARAMS_BOL),
+		// set t1 if read function is (offset, buffer, length)
+		ANDI(T1, V0, CODE_DUMP_PARAMS_OBL),
+		// set a0 = &buffer, a1 = offset, a2 = length
+		ADDIU(A0, S7, 0x14),
+		MOVE(A1, S1),
+		MOVE(A2, S2),
+		// if t0: set a0 = buffer
+		MOVN(A0, S0, T0),
+		// if t1: set a0 = offset and a1 = buffer
+		MOVN(A0, S1, T1),
+		MOVN(A1, S0, T1),
+		// read from flash
+		JALR(S4),
+		// leave this here!
+		NOP,
+		// reload buffer
+		LW(S0, 0x14, S7),
+
+_DEF_LABEL(L_CRC_START),
+		// block size
+		LW(S3, 0x20, S7),
+		// set s4 to print function
+		LW(S4, 0x24, S7),
+
+_DEF_LABEL(L_CRC_LOOP_BLOCK),
+		// set t2 to MIN(remaining length, block size)
+		MOVE(T2, S3),
+		SLT(T0, S2, S3),
+		MOVN(T2, S2, T0),
+		// decrement remaining length
+		SUBU(S2, S2, T2),
+		// polynomial (reflected)
+		LI(T3, 0xedb88320),
+		// crc = 0xffffffff
+		ADDIU(T1, ZERO, -1),
+
+_DEF_LABEL(L_CRC_LOOP_BYTES),
+		// crc ^= *s0++
+		LBU(T0, 0, S0),
+		ADDIU(S0, S0, 1),
+		XOR(T1, T1, T0),
+		// 8 bits per byte
+		ORI(V1, ZERO, 8),
+
+_DEF_LABEL(L_CRC_LOOP_BITS),
+		// crc = (crc >> 1) ^ (-(crc & 1) & poly)
+		ANDI(V0, T1, 1),
+		SUBU(V0, ZERO, V0),
+		AND(V0, V0, T3),
+		SRL(T1, T1, 1),
+		ADDIU(V1, V1, -1),
+		BGTZ(V1, L_CRC_LOOP_BITS),
+		// delay slot
+		XOR(T1, T1, V0),
+		// loop until block is done
+		ADDIU(T2, T2, -1),
+		BGTZ(T2, L_CRC_LOOP_BYTES),
+		// delay slot
+		NOP,
+		// printf(":%x", ~crc)
+		ADDIU(A0, S7, 4),
+		JALR(S4),
+		NOR(A1, T1, ZERO),
+		// printf("\r\n")
+		JALR(S4),
+		ADDIU(A0, S7, 8),
+		// branch to loop_block if length > 0
+		BGTZ(S2, L_CRC_LOOP_BLOCK),
+		// delay slot
+		NOP,
+
+_DEF_LABEL(L_CRC_OUT),
+		// restore registers
+		LW(RA, 0x00, SP),
+		LW(S7, 0x04, SP),
+		LW(S4, 0x08, SP),
+		LW(S3, 0x0c, SP),
+		LW(S2, 0x10, SP),
+		LW(S1, 0x14, SP),
+		LW(S0, 0x18, SP),
+		JR(RA),
+		ADDIU(SP, SP, 0x1c),
+		// checksum
+		_WORD(0)
+};
+
+#define L_FIND_LOOP_PATCH  ASM_LABEL(0)
+#define L_FIND_PATCH_DONE  ASM_LABEL(1)
+#define L_FIND_READ_FLASH  ASM_LABEL(2)
+#define L_FIND_START       ASM_LABEL(3)
+#define L_FIND_LOOP_POS    ASM_LABEL(4)
+#define L_FIND_LOOP_PAT    ASM_LABEL(5)
+#define L_FIND_LOOP_CMP    ASM_LABEL(6)
+#define L_FIND_NEXT_PAT    ASM_LABEL(7)
+#define L_FIND_NEXT_POS    ASM_LABEL(8)
+#define L_FIND_OUT         ASM_LABEL(9)
+
+// prints ":<offset>:<index>" for each match of a pattern in the requested
+// region, followed by ":<offset + positions>" when done. the pattern table
+// consists of (length, index, data) entries, with data padded to 4 bytes,
+// and is terminated by a zero length. only matches starting within the
+// first <positions> bytes are reported.
+uint32_t findcode[] = {
+		_WORD(CODE_MAGIC),
+		// ":%x"
+		_WORD(0x3a257800),
+		// "\r\n"
+		_WORD(0x0d0a0000),
+		_WORD(0), // flags
+		_WORD(0), // pattern table
+		_WORD(0), // buffer
+		_WORD(0), // offset
+		_WORD(0), // length
+		_WORD(0), // positions
+		_WORD(0), // printf
+		_WORD(0), // <flash read function>
+		_WORD(0), // <patch offset 1>
+		_WORD(0), // <patch word 1>
+		_WORD(0), // <patch offset 2>
+		_WORD(0), // <patch word 2>
+		_WORD(0), // <patch offset 3>
+		_WORD(0), // <patch word 3>
+		_WORD(0), // <patch offset 4>
+		_WORD(0), // <patch word 4>
+		// main:
+		ADDIU(SP, SP, -0x24),
+		SW(RA, 0x00, SP),
+		SW(S7, 0x04, SP),
+		SW(S6, 0x08, SP),
+		SW(S5, 0x0c, SP),
+		SW(S4, 0x10, SP),
+		SW(S3, 0x14, SP),
+		SW(S2, 0x18, SP),
+		SW(S1, 0x1c, SP),
+		SW(S0, 0x20, SP),
+		// branch to next instruction
+		BAL(1),
+		// delay slot: address mask
+		LUI(T0, 0xffff),
+		// store ra & 0xffff0000
+		AND(S7, RA, T0),
+		// buffer
+		LW(S0, 0x14, S7),
+		// offset
+		LW(S1, 0x18, S7),
+		// length
+		LW(S2, 0x1c, S7),
+		// bail out if length is zero
+		BEQZ(S2, L_FIND_OUT),
+		// delay slot: flash read function
+		LW(S4, 0x28, S7),
+		// maximum of 4 words can be patched
+		ORI(T0, ZERO, 4),
+		// pointer to first patch blob
+		ADDIU(T1, S7, 0x2c),
+
+_DEF_LABEL(L_FIND_LOOP_PATCH),
+		// load patch offset
+		LW(T2, 0, T1),
+		// break if patch offset is zero
+		BEQZ(T2, L_FIND_PATCH_DONE),
+		// delay slot: load patch word
+		LW(T3, 4, T1),
+		// patch word at t1
+		SW(T3, 0, T2),
+		// decrement counter
+		ADDIU(T0, T0, -1),
+		// loop until we've reached the end
+		BGTZ(T0, L_FIND_LOOP_PATCH),
+		// delay slot: set pointer to next patch blob
+		ADDIU(T1, T1, 8),
+
+_DEF_LABEL(L_FIND_PATCH_DONE),
+		// if S4 is null, we're reading RAM
+		BNEZ(S4, L_FIND_READ_FLASH),
+		// delay slot: load flags
+		LW(V0, 0x0c, S7),
+		B(L_FIND_START),
+		// delay slot: use memory offset as buffer
+		MOVE(S0, S1),
+
+_DEF_LABEL(L_FIND_READ_FLASH),
+		// set t0 if read function is (buffer, offset, length)
+		ANDI(T0, V0, CODE_DUMP_PARAMS_BOL),
+		// set t1 if read function is (offset, buffer, length)
+		ANDI(T1, V0, CODE_DUMP_PARAMS_OBL),
+		// set a0 = &buffer, a1 = offset, a2 = length
+		ADDIU(A0, S7, 0x14),
+		MOVE(A1, S1),
+		MOVE(A2, S2),
+		// if t0: set a0 = buffer
+		MOVN(A0, S0, T0),
+		// if t1: set a0 = offset and a1 = buffer
+		MOVN(A0, S1, T1),
+		MOVN(A1, S0, T1),
+		// read from flash
+		JALR(S4),
+		// leave this here!
+		NOP,
+		// reload buffer
+		LW(S0, 0x14, S7),
+
+_DEF_LABEL(L_FIND_START),
+		// number of positions to check
+		LW(S3, 0x20, S7),
+		// set s4 to print function
+		LW(S4, 0x24, S7),
+		// set s2 to end of buffer
+		ADDU(S2, S0, S2),
+		// current position
+		MOVE(S5, ZERO),
+
+_DEF_LABEL(L_FIND_LOOP_POS),
+		// set s6 to first pattern
+		LW(S6, 0x10, S7),
+
+_DEF_LABEL(L_FIND_LOOP_PAT),
+		// load pattern length; a zero length terminates the table
+		LW(T0, 0, S6),
+		BEQZ(T0, L_FIND_NEXT_POS),
+		// delay slot: set t1 to buffer + position
+		ADDU(T1, S0, S5),
+		// skip if pattern extends beyond the buffer
+		ADDU(T2, T1, T0),
+		SLT(T2, S2, T2),
+		BNEZ(T2, L_FIND_NEXT_PAT),
+		// delay slot: set t3 to pattern data
+		ADDIU(T3, S6, 8),
+
+_DEF_LABEL(L_FIND_LOOP_CMP),
+		LBU(V0, 0, T1),
+		LBU(V1, 0, T3),
+		BNE(V0, V1, L_FIND_NEXT_PAT),
+		// delay slot
+		ADDIU(T1, T1, 1),
+		ADDIU(T0, T0, -1),
+		BGTZ(T0, L_FIND_LOOP_CMP),
+		// delay slot
+		ADDIU(T3, T3, 1),
+		// printf(":%x", offset + position)
+		ADDIU(A0, S7, 4),
+		JALR(S4),
+		ADDU(A1, S1, S5),
+		// printf(":%x", index)
+		ADDIU(A0, S7, 4),
+		JALR(S4),
+		LW(A1, 4, S6),
+		// printf("\r\n")
+		JALR(S4),
+		ADDIU(A0, S7, 8),
+
+_DEF_LABEL(L_FIND_NEXT_PAT),
+		// set s6 to s6 + 8 + align(length, 4)
+		LW(T0, 0, S6),
+		ADDIU(T0, T0, 11),
+		SRL(T0, T0, 2),
+		SLL(T0, T0, 2),
+		B(L_FIND_LOOP_PAT),
+		// delay slot
+		ADDU(S6, S6, T0),
+
+_DEF_LABEL(L_FIND_NEXT_POS),
+		// loop until all positions have been checked
+		ADDIU(S5, S5, 1),
+		SLT(T0, S5, S3),
+		BNEZ(T0, L_FIND_LOOP_POS),
+		// delay slot
+		NOP,
+		// printf(":%x\r\n", offset + positions) to signal completion
+		ADDIU(A0, S7, 4),
+		JALR(S4),
+		ADDU(A1, S1, S3),
+		JALR(S4),
+		ADDIU(A0, S7, 8),
+
+_DEF_LABEL(L_FIND_OUT),
+		// restore registers
+		LW(RA, 0x00, SP),
+		LW(S7, 0x04, SP),
+		LW(S6, 0x08, SP),
+		LW(S5, 0x0c, SP),
+		LW(S4, 0x10, SP),
+		LW(S3, 0x14, SP),
+		LW(S2, 0x18, SP),
+		LW(S1, 0x1c, SP),
+		LW(S0, 0x20, SP),
+		JR(RA),
+		ADDIU(SP, SP, 0x24),
+		// checksum
+		_WORD(0)
+};
+
 #define L_LOOP ASM_LABEL(0)
 #define L_B2 ASM_LABEL(8)
 #define L_B3 ASM_LABEL(9)
@@ -17,10 +17,12 @@
  *
  */
 
-#include <boost/crc.hpp>
 #include <openssl/aes.h>
 #include <openssl/md5.h>
 #include <algorithm>
+#include <atomic>
+#include <future>
+#include <thread>
 #include "gwsettings.h"
 #include "nonvol.h"
 using namespace std;
@@ -28,20 +30,88 @@ using namespace bcm2dump;
 
 namespace bcm2cfg {
 namespace {
-string read_stream(istream& is)
+
+// below this size, starting threads costs more than it saves
+const size_t parallel_decode_min_bytes = 16 * 1024;
+
+// decodes lazily read groups. groups are independent of each other, so
+// they are decoded concurrently if there's enough data. if decoding fails,
+// the exception of the first failed group (in file order) is rethrown.
+void decode_groups(const nv_val::list& groups)
 {
-	string ret;
-	char buf[1024];
-	while (is.good()) {
-		auto bytes = is.readsome(buf, sizeof(buf));
-		if (!bytes) {
-			break;
+	size_t bytes = 0;
+	for (auto& g : groups) {
+		bytes += g.val->bytes();
+	}
+
+	unsigned threads = min<size_t>(thread::hardware_concurrency(), groups.size());
+	if (threads < 2 || bytes < parallel_decode_min_bytes) {
+		// share one arena between all groups, instead of one per group
+		nv_arena::scope arena;
+		for (auto& g : groups) {
+			nv_val_cast<nv_compound>(g.val)->parts();
+		}
+		return;
+	}
+
+	atomic<size_t> next{0};
+	vector<exception_ptr> errors(groups.size());
+
+	auto worker = [&groups, &next, &errors] () {
+		nv_arena::scope arena;
+		for (size_t i = next++; i < groups.size(); i = next++) {
+			try {
+				nv_val_cast<nv_compound>(groups[i].val)->parts();
+			} catch (...) {
+				errors[i] = current_exception();
+			}
 		}
+	};
 
-		ret += string(buf, bytes);
+	vector<future<void>> workers;
+	for (unsigned i = 1; i < threads; ++i) {
+		workers.push_back(async(launch::async, worker));
 	}
 
-	return ret;
+	worker();
+
+	for (auto& w : workers) {
+		w.get();
+	}
+
+	for (auto& e : errors) {
+		if (e) {
+			rethrow_exception(e);
+		}
+	}
+}
+
+// the unread part of a stream
+struct stream_data
+{
+	const char* data;
+	size_t size;
+};
+
+// for an imemstream, the returned data refers to its buffer, so nothing is
+// copied. any other stream is read into <storage>. in both cases, all
+// remaining data is consumed.
+stream_data read_stream(istream& is, string& storage)
+{
+	auto mem = dynamic_cast<imemstream*>(&is);
+	if (mem) {
+		size_t size = mem->remaining();
+		return { mem->take(size), size };
+	}
+
+	char buf[16 * 1024];
+	while (is.read(buf, sizeof(buf)) || is.gcount()) {
+		storage.append(buf, is.gcount());
+	}
+
+	// running out of data isn't an error here
+	is.clear(ios::eofbit);
+	return { storage.data(), storage.size() };
 }
 
 string group_header_to_string(const string& type, const string& checksum, bool is_chksum_valid, size_t size, bool is_size_valid,
@@ -89,8 +159,10 @@ class permdyn : public settings
 			throw runtime_error("found non-0xff byte in magic");
 		}
 
-		string buf = read_stream(is).substr(0, m_size.num() + 16);
-		uint32_t crc = crc32(buf);
+		string storage;
+		stream_data buf = read_stream(is, storage);
+		buf.size = min<size_t>(buf.size, m_size.num() + 16);
+		uint32_t crc = crc32(buf.data, buf.size);
 
 		if (crc == m_checksum.num()) {
 			logger::e() << "checksum ok: " << to_hex(crc) << endl;
@@ -98,7 +170,7 @@ class permdyn : public settings
 			logger::e() << "checksum mismatch: " << to_hex(crc) << " / " << to_hex(m_checksum.num()) << endl;
 		}
 
-		istringstream istr(buf);
+		imemstream istr(buf.data, buf.size);
 		settings::read(istr);
 
 		return is;
@@ -114,7 +186,7 @@ class permdyn : public settings
 			throw runtime_error("failed to write magic");
 		}
 
-		if (!nv_u32(8 + buf.size()).write(os) || !nv_u32(crc32(buf)).write(os)) {
+		if (!nv_u32(8 + buf.size()).write(os) || !nv_u32(crc32(buf.data(), buf.size())).write(os)) {
 			throw runtime_error("failed to write header");
 		}
 
@@ -132,10 +204,9 @@ class permdyn : public settings
 	}
 
 	private:
-	static uint32_t crc32(const string& buf)
+	static uint32_t crc32(const char* buf, size_t size)
 	{
-		boost::crc_32_type crc;
-		return for_each(buf.begin(), buf.end(), crc)() ^ 0xffffffff;
+		return crc32_ieee(buf, size) ^ 0xffffffff;
 	}
 
 	nv_u32 m_size;
@@ -160,25 +231,26 @@ class gwsettings : public settings
 
 	virtual istream& read(istream& is) override
 	{
-		string buf = read_stream(is);
-		string magic = buf.substr(0, s_magic.size());
+		// if the file is encrypted, storage holds the decrypted data
+		string storage;
+		stream_data buf = read_stream(is, storage);
 		validate_checksum_and_detect_profile(buf);
-		m_magic_valid = (magic == s_magic);
+		m_magic_valid = has_magic(buf);
 
-		if (!m_magic_valid && !decrypt_and_detect_profile(buf)) {
+		if (!m_magic_valid && !decrypt_and_detect_profile(buf, storage)) {
 			m_encrypted = true;
 			return is;
 		}
 
-		istringstream istr(buf.substr(s_magic.size()));
+		imemstream istr(buf.data + s_magic.size(), buf.size - s_magic.size());
 		if (!m_version.read(istr) || !m_size.read(istr)) {
 			throw runtime_error("error while reading header");
 		}
 
-		m_size_valid = m_size.num() == buf.size();
+		m_size_valid = m_size.num() == buf.size;
 
 		if (!m_size_valid) {
-			if (m_size.num() + 16 == buf.size()) {
+			if (m_size.num() + 16 == buf.size) {
 				m_padded = true;
 				m_size_valid = true;
 			}
@@ -211,7 +283,7 @@ class gwsettings : public settings
 			buf = crypt(buf, m_key, false, m_padded);
 		}
 
-		if (!(os << calc_checksum(buf, m_profile))) {
+		if (!(os << calc_checksum(buf.data(), buf.size(), m_profile))) {
 			throw runtime_error("error while writing checksum");
 		}
 
@@ -236,7 +308,12 @@ class gwsettings : public settings
 	private:
 	string m_checksum;
 
-	void validate_checksum_and_detect_profile(const string& buf)
+	static bool has_magic(const stream_data& buf)
+	{
+		return buf.size >= s_magic.size() && !s_magic.compare(0, s_magic.size(), buf.data, s_magic.size());
+	}
+
+	void validate_checksum_and_detect_profile(const stream_data& buf)
 	{
 		if (profile()) {
 			validate_checksum(buf, profile());
@@ -251,17 +328,17 @@ class gwsettings : public settings
 		}
 	}
 
-	bool validate_checksum(const string& buf, const csp<bcm2dump::profile>& p)
+	bool validate_checksum(const stream_data& buf, const csp<bcm2dump::profile>& p)
 	{
-		m_checksum_valid = (m_checksum == calc_checksum(buf, p));
+		m_checksum_valid = (m_checksum == calc_checksum(buf.data, buf.size, p));
 		return m_checksum_valid;
 	}
 
-	static string calc_checksum(const string& buf, const csp<bcm2dump::profile>& p)
+	static string calc_checksum(const char* buf, size_t size, const csp<bcm2dump::profile>& p)
 	{
 		MD5_CTX c;
 		MD5_Init(&c);
-		MD5_Update(&c, buf.data(), buf.size());
+		MD5_Update(&c, buf, size);
 
 		string key = p ? p->md5_key() : "";
 		if (!key.empty()) {
@@ -273,15 +350,15 @@ class gwsettings : public settings
 		return md5;
 	}
 
-	bool decrypt_and_detect_profile(string& buf)
+	bool decrypt_and_detect_profile(stream_data& buf, string& storage)
 	{
 		if (!m_key.empty()) {
-			return decrypt(buf, m_key);
+			return decrypt(buf, storage, m_key);
 		} else if (profile()) {
-			return decrypt_with_profile(buf, profile());
+			return decrypt_with_profile(buf, storage, profile());
 		} else {
 			for (auto p : profile::list()) {
-				if (decrypt_with_profile(buf, p)) {
+				if (decrypt_with_profile(buf, storage, p)) {
 					return true;
 				}
 			}
@@ -290,10 +367,10 @@ class gwsettings : public settings
 		return false;
 	}
 
-	bool decrypt_with_profile(string& buf, const csp<bcm2dump::profile>& p)
+	bool decrypt_with_profile(stream_data& buf, string& storage, const csp<bcm2dump::profile>& p)
 	{
 		for (auto k : p->default_keys()) {
-			if (decrypt(buf, k)) {
+			if (decrypt(buf, storage, k)) {
 				m_key = k;
 				return true;
 			}
@@ -302,11 +379,12 @@ class gwsettings : public settings
 		return false;
 	}
 
-	bool decrypt(string& buf, const string& key)
+	bool decrypt(stream_data& buf, string& storage, const string& key)
 	{
-		string decrypted = crypt(buf, key, true);
-		if (decrypted.substr(0, 74) == s_magic) {
-			buf = decrypted;
+		string decrypted = crypt(string(buf.data, buf.size), key, true);
+		if (!decrypted.compare(0, s_magic.size(), s_magic)) {
+			storage = move(decrypted);
+			buf = { storage.data(), storage.size() };
 			m_magic_valid = true;
 			return true;
 		}
@@ -376,8 +454,12 @@ istream& settings::read(istream& is)
 	size_t remaining = data_bytes();
 	unsigned mult = 1;
 
+	// only the group headers are parsed here; the group data is
+	// decoded later, possibly in parallel, unless m_lazy is set. if
+	// it isn't, the data is decoded before we return, so it doesn't
+	// have to be copied, if <is> is an imemstream.
 	while (remaining && !is.eof()) {
-		if (!nv_group::read(is, group, m_type, remaining) && !is.eof()) {
+		if (!nv_group::read(is, group, m_type, remaining, true, !m_lazy) && !is.eof()) {
 			if (!m_permissive) {
 				throw runtime_error("failed to read group " + group->magic().to_str());
 			}
@@ -395,11 +477,15 @@ istream& settings::read(istream& is)
 		}
 	}
 
+	if (!m_lazy) {
+		decode_groups(m_groups);
+	}
+
 	return is;
 }
 
 
-sp<settings> settings::read(istream& is, int type, const csp<bcm2dump::profile>& p, const std::string& key)
+sp<settings> settings::read(istream& is, int type, const csp<bcm2dump::profile>& p, const std::string& key, bool lazy)
 {
 	string start(16, '\0');
 	if (!is.read(&start[0], start.size())) {
@@ -422,6 +508,7 @@ sp<settings> settings::read(istream& is, int type, const csp<bcm2dump::profile>&
 	}
 
 	if (ret) {
+		ret->m_lazy = lazy;
 		ret->read(is);
 	}
 
@@ -45,7 +45,9 @@ class settings : public nv_compound
 
 	virtual std::string header_to_string() const = 0;
 
-	static sp<settings> read(std::istream& is, int type, const csp<bcm2dump::profile>& profile, const std::string& key);
+	// if <lazy> is true, groups are only decoded when they're accessed (see nv_group::read)
+	static sp<settings> read(std::istream& is, int type, const csp<bcm2dump::profile>& profile,
+			const std::string& key, bool lazy = false);
 
 	protected:
 	settings(const std::string& name, int type, const csp<bcm2dump::profile>& p)
@@ -62,6 +64,7 @@ class settings : public nv_compound
 	private:
 	int m_type;
 	bool m_permissive = false;
+	bool m_lazy = false;
 	list m_groups;
 };
 }
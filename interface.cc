@@ -24,6 +24,7 @@
 #include <netdb.h>
 #include <list>
 #include "interface.h"
+#include "metrics.h"
 #include "rwx.h"
 using namespace std;
 
@@ -202,6 +203,7 @@ void bfc_telnet::runcmd(const string& cmd)
 
 bool bfc_telnet::login(const string& user, const string& pass)
 {
+	metrics::timer t("interface.login");
 	bool send_crlf = true;
 
 	while (pending(1000)) {
@@ -271,6 +273,7 @@ bool bfc_telnet::login(const string& user, const string& pass)
 
 interface::sp detect_interface(const io::sp &io)
 {
+	metrics::timer t("interface.detect");
 	interface::sp intf = make_shared<bfc_telnet>();
 	if (intf->is_active(io)) {
 		return intf;
@@ -296,6 +299,7 @@ void detect_profile_if_not_set(const interface::sp& intf, const profile::sp& pro
 		return;
 	}
 
+	metrics::timer t("interface.detect_profile");
 	rwx::sp ram = rwx::create(intf, "ram", true);
 
 	// if device A's magic is at an offset that is invalid for device
@@ -342,7 +346,7 @@ bool interface::runcmd(const string& cmd, const string& expect, bool stop_on_mat
 
 bool interface::foreach_line(function<bool(const string&)> f, unsigned timeout, unsigned timeout_line) const
 {
-	clock_t start = clock();
+	auto start = chrono::steady_clock::now();
 
 	while (pending(timeout_line) && (!timeout || elapsed_millis(start) < timeout)) {
 		string line = readln();
@@ -367,6 +371,7 @@ interface::sp interface::detect(const io::sp& io, const profile::sp& profile)
 
 interface::sp interface::create(const string& spec, const string& profile_name)
 {
+	metrics::timer t("interface.create");
 	profile::sp profile;
 	if (!profile_name.empty()) {
 		profile = profile::get(profile_name);
@@ -389,7 +394,7 @@ interface::sp interface::create(const string& spec, const string& profile_name)
 		} else if (tokens.size() == 3 || tokens.size() == 4) {
 			type = "telnet";
 		} else {
-			throw invalid_argument("ambiguous interface: '" + spec + "'; use <type>: prefix (serial/tcp/telnet)");
+			throw invalid_argument("ambiguous interface: '" + spec + "'; use <type>: prefix (serial/tcp/telnet/replay)");
 		}
 	}
 
@@ -415,6 +420,9 @@ interface::sp interface::create(const string& spec, const string& profile_name)
 
 			detect_profile_if_not_set(intf, profile);
 			return intf;
+		} else if (type == "replay") {
+			bool realtime = tokens.size() == 2 && tokens[1] == "realtime";
+			return detect(io::open_replay(tokens[0], realtime), profile);
 		}
 	} catch (const bad_lexical_cast& e) {
 		throw invalid_argument("invalid " + type + " interface: " + e.what());
@@ -26,9 +26,18 @@
 #include <unistd.h>
 #include <netdb.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <condition_variable>
 #include <cstring>
 #include <cerrno>
+#include <chrono>
+#include <thread>
+#include <random>
+#include <atomic>
+#include <vector>
+#include <mutex>
 #include <list>
+#include "metrics.h"
 #include "util.h"
 #include "io.h"
 using namespace std;
@@ -40,17 +49,39 @@ typedef runtime_error user_error;
 namespace bcm2dump {
 namespace {
 
-list<string> lines;
+// the most recent lines, as received or sent. lines are stored as-is,
+// and are only formatted if they're actually needed (i.e. when tracing,
+// or in get_last_lines()), so that a fast dump doesn't pay for it.
+struct history_line
+{
+	string data;
+	bool in;
+};
+
+history_line history[50];
+size_t history_count = 0;
 
-void add_line(const string& line, bool in)
+string format_line(const string& data, bool in)
 {
-	if (lines.size() == 50) {
-		lines.pop_front();
+	string ret = in ? "==> " : "<== ";
+
+	if (in && data.empty()) {
+		ret += "(empty)";
+	} else {
+		ret += "'" + (in ? data : trim(data)) + "'";
 	}
 
-	lines.push_back((in ? "==> " : "<== ") + line);
+	return ret;
+}
+
+void add_line(const string& data, bool in)
+{
+	history_line& h = history[history_count++ % (sizeof(history) / sizeof(history[0]))];
+	// assign() reuses the existing buffer
+	h.data.assign(data);
+	h.in = in;
 
-	logger::t() << lines.back() << endl;
+	LOG_T << format_line(data, in) << endl;
 }
 
 class scoped_flags
@@ -203,10 +234,81 @@ unsigned to_termspeed(unsigned speed)
 	}
 }
 
+// lock-free ring buffer for exactly one producer and one consumer thread.
+// head and tail are never wrapped; size must be a power of two.
+template<class T> class spsc_ring
+{
+	public:
+	spsc_ring(size_t size) : m_buf(size) {}
+
+	size_t size() const
+	{ return m_tail.load(memory_order_acquire) - m_head.load(memory_order_acquire); }
+
+	bool empty() const
+	{ return !size(); }
+
+	// producer only
+	size_t space() const
+	{ return m_buf.size() - size(); }
+
+	// producer only
+	size_t put(const T* buf, size_t length)
+	{
+		size_t head = m_head.load(memory_order_acquire);
+		size_t tail = m_tail.load(memory_order_relaxed);
+		length = min(length, m_buf.size() - (tail - head));
+
+		for (size_t i = 0; i < length; ++i) {
+			m_buf[(tail + i) & (m_buf.size() - 1)] = buf[i];
+		}
+
+		m_tail.store(tail + length, memory_order_release);
+		return length;
+	}
+
+	// consumer only
+	bool peek(T& t) const
+	{
+		size_t tail = m_tail.load(memory_order_acquire);
+		size_t head = m_head.load(memory_order_relaxed);
+		if (tail == head) {
+			return false;
+		}
+
+		t = m_buf[head & (m_buf.size() - 1)];
+		return true;
+	}
+
+	// consumer only
+	size_t get(T* buf, size_t length)
+	{
+		size_t tail = m_tail.load(memory_order_acquire);
+		size_t head = m_head.load(memory_order_relaxed);
+		length = min(length, tail - head);
+
+		for (size_t i = 0; i < length; ++i) {
+			buf[i] = m_buf[(head + i) & (m_buf.size() - 1)];
+		}
+
+		m_head.store(head + length, memory_order_release);
+		return length;
+	}
+
+	private:
+	vector<T> m_buf;
+	atomic<size_t> m_head{0};
+	atomic<size_t> m_tail{0};
+};
+
+// a reader thread constantly drains the file descriptor into a ring
+// buffer, so that the device's output isn't lost (i.e. the serial port
+// isn't overrun) while we're busy parsing or writing data. errors are
+// reported to the consumer once the ring buffer is empty. the arrival
+// time of each read() is kept as well, for last_arrival().
 class fdio : public io
 {
 	public:
-	fdio() : m_fd(-1) {}
+	fdio() : m_fd(-1), m_ring(1 << 20), m_arrivals(1 << 12) {}
 
 	virtual ~fdio()
 	{ close(); }
@@ -215,14 +317,47 @@ class fdio : public io
 	virtual void write(const string& str) override;
 	virtual string read(size_t length, bool partial = true) override;
 
+	virtual chrono::steady_clock::time_point last_arrival() override
+	{ return m_last_arrival; }
+
 	protected:
-	virtual void close()
-	{ ::close(m_fd); }
+	virtual void close();
 
 	virtual int getc() override;
-	virtual ssize_t read1(char &c);
+
+	// must be called once m_fd is valid
+	void start_reader();
 
 	int m_fd;
+
+	private:
+	struct arrival
+	{
+		// position in the stream of the first byte after the data
+		size_t end;
+		chrono::steady_clock::time_point time;
+	};
+
+	void reader_loop();
+	void reader_failed(exception_ptr error);
+	void consumed(size_t length);
+	bool readable() const
+	{ return !m_ring.empty() || m_failed.load(memory_order_acquire); }
+
+	spsc_ring<char> m_ring;
+	spsc_ring<arrival> m_arrivals;
+	// reader thread only
+	size_t m_received = 0;
+	// consumer only
+	size_t m_consumed = 0;
+	chrono::steady_clock::time_point m_last_arrival;
+	thread m_reader;
+	atomic<bool> m_stop{false};
+	atomic<bool> m_failed{false};
+	exception_ptr m_error;
+	// only used for sleeping; the ring buffer itself is lock-free
+	mutex m_mutex;
+	condition_variable m_cv;
 };
 
 class serial : public fdio
@@ -242,10 +377,6 @@ class tcp : public fdio
 	virtual void write(const string& str) override;
 	virtual void writeln(const string& str) override
 	{ write(str + "\r\n"); }
-	virtual string read(size_t length, bool partial = true) override;
-
-	protected:
-	virtual ssize_t read1(char& c) override;
 };
 
 class telnet : public tcp
@@ -277,59 +408,162 @@ class telnet : public tcp
 
 bool fdio::pending(unsigned timeout)
 {
-	fd_set fds;
-	FD_ZERO(&fds);
-	FD_SET(m_fd, &fds);
-
-	timeval tv;
-	tv.tv_sec = timeout / 1000;
-	tv.tv_usec = 1000 * (timeout % 1000);
-
-	int ret = select(m_fd + 1, &fds, NULL, NULL, &tv);
-	if (ret < 0) {
-		throw errno_error("select");
+	if (readable()) {
+		return true;
 	}
 
-	return ret;
+	unique_lock<mutex> lock(m_mutex);
+	return m_cv.wait_for(lock, chrono::milliseconds(timeout), [this] { return readable(); });
 }
 
 int fdio::getc()
 {
 	char c;
-	ssize_t ret = read1(c);
-	if (ret == 1) {
+	if (m_ring.get(&c, 1)) {
+		consumed(1);
 		return c & 0xff;
-	} else if (errno == EWOULDBLOCK || errno == EAGAIN) {
-		return eof;
-	} else {
-		throw errno_error("read1");
+	} else if (m_failed.load(memory_order_acquire)) {
+		rethrow_exception(m_error);
 	}
-}
 
-ssize_t fdio::read1(char& c)
-{
-	return ::read(m_fd, &c, 1);
+	return eof;
 }
 
 string fdio::read(size_t length, bool all)
 {
 	string buf(length, '\0');
-	ssize_t read = ::read(m_fd, &buf[0], length);
-	if (read < 0 || (all && read < length)) {
-		throw errno_error("read");
+	size_t read = m_ring.get(&buf[0], length);
+
+	while (all && read < length) {
+		if (!pending(1000)) {
+			throw runtime_error("read: timeout");
+		}
+
+		size_t n = m_ring.get(&buf[read], length - read);
+		if (!n && m_failed.load(memory_order_acquire)) {
+			rethrow_exception(m_error);
+		}
+
+		read += n;
 	}
 
+	consumed(read);
 	buf.resize(read);
 	return buf;
 }
 
+void fdio::consumed(size_t length)
+{
+	if (!length) {
+		return;
+	}
+
+	m_consumed += length;
+
+	// the last byte that was consumed belongs to the first arrival that
+	// ends at or after it. the reader thread adds arrivals before their
+	// data, so there always is one.
+	arrival a;
+	while (m_arrivals.peek(a)) {
+		if (a.end >= m_consumed) {
+			m_last_arrival = a.time;
+			if (a.end == m_consumed) {
+				m_arrivals.get(&a, 1);
+			}
+			break;
+		}
+
+		m_arrivals.get(&a, 1);
+	}
+}
+
+void fdio::close()
+{
+	if (m_reader.joinable()) {
+		m_stop = true;
+		m_reader.join();
+	}
+
+	if (m_fd >= 0) {
+		::close(m_fd);
+		m_fd = -1;
+	}
+}
+
+void fdio::start_reader()
+{
+	m_reader = thread(&fdio::reader_loop, this);
+}
+
+void fdio::reader_loop()
+{
+	static metrics::counter bytes_in("io.wire_bytes_in");
+	char buf[4096];
+
+	while (!m_stop) {
+		size_t space = min(m_ring.space(), sizeof(buf));
+		if (!space || !m_arrivals.space()) {
+			// the consumer can't keep up, so we'll let the data pile
+			// up in the kernel's buffers for now.
+			this_thread::sleep_for(chrono::milliseconds(1));
+			continue;
+		}
+
+		pollfd pfd = { m_fd, POLLIN, 0 };
+		int ret = poll(&pfd, 1, 50);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			reader_failed(make_exception_ptr(errno_error("poll")));
+			break;
+		} else if (!ret) {
+			continue;
+		}
+
+		ssize_t n = ::read(m_fd, buf, space);
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+				continue;
+			}
+
+			reader_failed(make_exception_ptr(errno_error("read")));
+			break;
+		} else if (!n) {
+			reader_failed(make_exception_ptr(runtime_error("connection closed")));
+			break;
+		}
+
+		m_received += n;
+		arrival a = { m_received, chrono::steady_clock::now() };
+		m_arrivals.put(&a, 1);
+		m_ring.put(buf, n);
+		bytes_in.add(n);
+
+		lock_guard<mutex> lock(m_mutex);
+		m_cv.notify_all();
+	}
+}
+
+void fdio::reader_failed(exception_ptr error)
+{
+	m_error = error;
+	m_failed.store(true, memory_order_release);
+
+	lock_guard<mutex> lock(m_mutex);
+	m_cv.notify_all();
+}
+
 void fdio::write(const string& str)
 {
 	if (::write(m_fd, str.data(), str.size()) != str.size()) {
 		throw errno_error("write");
 	}
+
+	metrics::count("io.wire_bytes_out", str.size());
 #ifdef DEBUG
-	add_line("'" + trim(str) + "'", false);
+	add_line(str, false);
 #endif
 }
 
@@ -381,6 +615,8 @@ serial::serial(const char* tty, unsigned speed)
 	if (tcsetattr(m_fd, TCSANOW, &cf) != 0) {
 		throw errno_error("tcsetattr");
 	}
+
+	start_reader();
 }
 
 tcp::tcp(const string& addr, uint16_t port)
@@ -428,6 +664,8 @@ tcp::tcp(const string& addr, uint16_t port)
 	if (error) {
 		throw system_error(error, system_category());
 	}
+
+	start_reader();
 }
 
 void tcp::write(const string& str)
@@ -435,28 +673,13 @@ void tcp::write(const string& str)
 	if (send(m_fd, str.data(), str.size(), MSG_NOSIGNAL) != str.size()) {
 		throw errno_error("send");
 	}
+
+	metrics::count("io.wire_bytes_out", str.size());
 	#ifdef DEBUG
-	add_line("'" + trim(str) + "'", false);
+	add_line(str, false);
 	#endif
 }
 
-ssize_t tcp::read1(char& c)
-{
-	return recv(m_fd, &c, 1, MSG_DONTWAIT);
-}
-
-string tcp::read(size_t length, bool all)
-{
-	string buf(length, '\0');
-	ssize_t read = recv(m_fd, &buf[0], length, MSG_DONTWAIT);
-	if (read < 0 || (all && read < length)) {
-		throw errno_error("read");
-	}
-
-	buf.resize(read);
-	return buf;
-}
-
 void telnet::write(const string& str)
 {
 	string::size_type i = str.find_first_of("\xff\r");
@@ -552,8 +775,561 @@ void telnet::close()
 {
 	tcp::close();
 }
+
+// session recordings consist of an 8-byte magic, followed by the wall-clock
+// time (unix epoch, microseconds) at which the recording was started, and a
+// sequence of events:
+//
+//   u8  type (see below)
+//   u32 time since previous event, in microseconds
+//   u16 length of data
+//   data
+//
+// input events are timestamped when their data arrived (see
+// io::last_arrival()), rather than when it was consumed, so that
+// the recording reflects the timing of the link, not of the tool.
+//
+// all numbers are stored in network byte order.
+
+const string rec_magic = "BCM2REC\x01";
+
+const char rec_in = 'i';
+const char rec_write = 'w';
+const char rec_writeln = 'l';
+const char rec_eof = 'e';
+const char rec_ign = 'g';
+// pending() returned false; data is the timeout (u32)
+const char rec_timeout = 't';
+// pending() had to wait for data; data is the time spent waiting, in
+// microseconds (u32). only recorded for waits of 1 ms or more.
+const char rec_wait = 'p';
+// no data; precedes an event whose delta would overflow the u32 field (after
+// about 71 minutes), and carries the part of the delta that didn't fit.
+const char rec_skip = 's';
+
+const size_t rec_max_in = 1024;
+
+class recorder : public io
+{
+	public:
+	recorder(const io::sp& io, const string& filename);
+	virtual ~recorder();
+
+	virtual int getc() override;
+	virtual string read(size_t length, bool partial = true) override;
+	virtual void writeln(const string& str) override;
+	virtual void write(const string& str) override;
+	virtual bool pending(unsigned timeout) override;
+
+	virtual chrono::steady_clock::time_point last_arrival() override
+	{ return m_io->last_arrival(); }
+
+	private:
+	void record(char type, const string& data = "",
+			chrono::steady_clock::time_point time = chrono::steady_clock::now());
+	void write_event(char type, uint32_t delta, const string& data);
+	void flush_input();
+
+	io::sp m_io;
+	ofstream m_out;
+	string m_in;
+	// arrival time of the last byte in m_in
+	chrono::steady_clock::time_point m_in_time;
+	chrono::steady_clock::time_point m_last;
+};
+
+recorder::recorder(const io::sp& io, const string& filename)
+: m_io(io), m_out(filename, ios::binary | ios::trunc)
+{
+	if (!m_out.good()) {
+		throw user_error("failed to open " + filename + " for writing");
+	}
+
+	uint64_t now = chrono::duration_cast<chrono::microseconds>(
+			chrono::system_clock::now().time_since_epoch()).count();
+	uint32_t buf[2] = { htonl(now >> 32), htonl(now & 0xffffffff) };
+
+	m_out.write(rec_magic.data(), rec_magic.size());
+	m_out.write(reinterpret_cast<const char*>(buf), sizeof(buf));
+	m_last = chrono::steady_clock::now();
+}
+
+recorder::~recorder()
+{
+	try {
+		flush_input();
+	} catch (...) {}
+}
+
+int recorder::getc()
+{
+	int c = m_io->getc();
+	if (c == eof || c == ign) {
+		flush_input();
+		record(c == eof ? rec_eof : rec_ign);
+	} else {
+		m_in += char(c);
+		m_in_time = m_io->last_arrival();
+		if (c == '\n' || m_in.size() >= rec_max_in) {
+			flush_input();
+		}
+	}
+
+	return c;
+}
+
+string recorder::read(size_t length, bool partial)
+{
+	string buf = m_io->read(length, partial);
+	flush_input();
+
+	auto time = m_io->last_arrival();
+	for (size_t i = 0; i < buf.size(); i += rec_max_in) {
+		record(rec_in, buf.substr(i, rec_max_in), time);
+	}
+
+	return buf;
+}
+
+void recorder::writeln(const string& str)
+{
+	flush_input();
+	m_io->writeln(str);
+	record(rec_writeln, str);
+}
+
+void recorder::write(const string& str)
+{
+	flush_input();
+	m_io->write(str);
+	record(rec_write, str);
+}
+
+bool recorder::pending(unsigned timeout)
+{
+	auto start = chrono::steady_clock::now();
+
+	if (m_io->pending(timeout)) {
+		uint32_t waited = chrono::duration_cast<chrono::microseconds>(
+				chrono::steady_clock::now() - start).count();
+		if (waited >= 1000) {
+			flush_input();
+			waited = htonl(waited);
+			record(rec_wait, string(reinterpret_cast<const char*>(&waited), 4));
+		}
+		return true;
+	}
+
+	flush_input();
+	uint32_t n = htonl(timeout);
+	record(rec_timeout, string(reinterpret_cast<const char*>(&n), 4));
+	return false;
+}
+
+void recorder::record(char type, const string& data, chrono::steady_clock::time_point time)
+{
+	if (data.size() > 0xffff) {
+		throw invalid_argument("event data exceeds maximum length");
+	}
+
+	// events are recorded in the order in which they were consumed, so
+	// data that arrived before the previous event was consumed is
+	// recorded as if it had arrived at the same time.
+	time = max(time, m_last);
+	uint64_t delta = chrono::duration_cast<chrono::microseconds>(time - m_last).count();
+	m_last = time;
+
+	for (; delta > 0xffffffff; delta -= 0xffffffff) {
+		write_event(rec_skip, 0xffffffff, "");
+	}
+
+	write_event(type, delta, data);
+}
+
+void recorder::write_event(char type, uint32_t delta, const string& data)
+{
+	delta = htonl(delta);
+	uint16_t length = htons(data.size());
+
+	m_out.put(type);
+	m_out.write(reinterpret_cast<const char*>(&delta), 4);
+	m_out.write(reinterpret_cast<const char*>(&length), 2);
+	m_out.write(data.data(), data.size());
+
+	if (!m_out.good()) {
+		throw runtime_error("failed to write session recording");
+	}
+}
+
+void recorder::flush_input()
+{
+	if (!m_in.empty()) {
+		record(rec_in, m_in, m_in_time);
+		m_in.clear();
+	}
+}
+
+class replay : public io
+{
+	public:
+	replay(const string& filename, bool realtime);
+	virtual ~replay() {}
+
+	virtual int getc() override;
+	virtual string read(size_t length, bool partial = true) override;
+	virtual void writeln(const string& str) override;
+	virtual void write(const string& str) override;
+	virtual bool pending(unsigned timeout) override;
+
+	private:
+	struct event
+	{
+		char type;
+		string data;
+	};
+
+	bool next_event();
+	bool wait_for_event();
+	void consume_write(char type, const string& str);
+
+	ifstream m_in;
+	bool m_realtime;
+	bool m_have_event = false;
+	event m_event;
+	size_t m_pos = 0;
+	// time at which the current event becomes available
+	chrono::steady_clock::time_point m_due;
+};
+
+replay::replay(const string& filename, bool realtime)
+: m_in(filename, ios::binary), m_realtime(realtime)
+{
+	if (!m_in.good()) {
+		throw user_error("failed to open " + filename);
+	}
+
+	string magic(rec_magic.size(), '\0');
+	uint32_t start[2];
+
+	if (!m_in.read(&magic[0], magic.size()) || magic != rec_magic
+			|| !m_in.read(reinterpret_cast<char*>(start), sizeof(start))) {
+		throw user_error(filename + ": not a session recording");
+	}
+}
+
+bool replay::next_event()
+{
+	if (m_have_event && m_pos < m_event.data.size()) {
+		return true;
+	}
+
+	m_have_event = false;
+	m_pos = 0;
+
+	char type;
+	uint32_t delta;
+	uint16_t length;
+	uint64_t waited = 0;
+
+	do {
+		if (!m_in.get(type) || !m_in.read(reinterpret_cast<char*>(&delta), 4)
+				|| !m_in.read(reinterpret_cast<char*>(&length), 2)) {
+			return false;
+		}
+
+		m_event.type = type;
+		m_event.data.resize(ntohs(length));
+
+		if (!m_in.read(&m_event.data[0], m_event.data.size())) {
+			throw runtime_error("truncated session recording");
+		}
+
+		// waits are only informational, but their delay still counts
+		waited += ntohl(delta);
+	} while (type == rec_wait || type == rec_skip);
+
+	m_due = chrono::steady_clock::now() + chrono::microseconds(waited);
+
+	m_have_event = true;
+	return true;
+}
+
+bool replay::wait_for_event()
+{
+	if (!next_event()) {
+		return false;
+	} else if (m_realtime) {
+		// recorded timeouts are part of the recording, so we always
+		// wait for the full delay, regardless of the timeout argument.
+		this_thread::sleep_until(m_due);
+	}
+
+	return true;
+}
+
+bool replay::pending(unsigned timeout)
+{
+	if (!wait_for_event()) {
+		return false;
+	}
+
+	switch (m_event.type) {
+	case rec_timeout:
+		m_have_event = false;
+		return false;
+	case rec_write:
+	case rec_writeln:
+		// the device is waiting for input
+		return false;
+	default:
+		return true;
+	}
+}
+
+int replay::getc()
+{
+	if (!next_event()) {
+		return eof;
+	}
+
+	if (m_event.type == rec_in) {
+		return m_event.data[m_pos++] & 0xff;
+	}
+
+	m_have_event = false;
+
+	if (m_event.type == rec_ign) {
+		return ign;
+	}
+
+	return eof;
+}
+
+string replay::read(size_t length, bool all)
+{
+	string buf;
+
+	while (buf.size() < length && next_event() && m_event.type == rec_in) {
+		size_t n = min(length - buf.size(), m_event.data.size() - m_pos);
+		buf += m_event.data.substr(m_pos, n);
+		m_pos += n;
+	}
+
+	if (all && buf.size() < length) {
+		throw runtime_error("read: replay ended prematurely");
+	}
+
+	return buf;
+}
+
+void replay::consume_write(char type, const string& str)
+{
+	// skip all events that the recorded session would have consumed
+	// before writing the data
+	while (next_event() && m_event.type != rec_write && m_event.type != rec_writeln) {
+		if (m_event.type == rec_in) {
+			LOG_T << "replay: discarding " << m_event.data.size() - m_pos << " b" << endl;
+		}
+		m_have_event = false;
+	}
+
+	if (!m_have_event) {
+		logger::d() << "replay: unexpected write after end of recording" << endl;
+		return;
+	} else if (m_event.type != type || m_event.data != str) {
+		logger::d() << "replay: expected write '" << trim(m_event.data)
+				<< "', got '" << trim(str) << "'" << endl;
+	}
+
+	m_have_event = false;
+#ifdef DEBUG
+	add_line(str, false);
+#endif
+}
+
+void replay::write(const string& str)
+{
+	consume_write(rec_write, str);
+}
+
+void replay::writeln(const string& str)
+{
+	consume_write(rec_writeln, str);
 }
 
+class faulty : public io
+{
+	public:
+	faulty(const io::sp& io, const string& spec);
+	virtual ~faulty();
+
+	virtual int getc() override;
+	virtual string read(size_t length, bool partial = true) override;
+	virtual void writeln(const string& str) override;
+	virtual void write(const string& str) override;
+	virtual bool pending(unsigned timeout) override;
+
+	virtual chrono::steady_clock::time_point last_arrival() override
+	{ return m_io->last_arrival(); }
+
+	private:
+	bool roll(double p)
+	{ return p > 0 && m_dist(m_rng) < p; }
+
+	int mangle(int c);
+	void check_connected();
+
+	io::sp m_io;
+	mt19937 m_rng;
+	uniform_real_distribution<double> m_dist;
+	string m_junk;
+	bool m_disconnected = false;
+
+	double m_p_drop = 0;
+	double m_p_flip = 0;
+	double m_p_junk = 0;
+	double m_p_stall = 0;
+	double m_p_disconnect = 0;
+
+	unsigned m_drops = 0;
+	unsigned m_flips = 0;
+	unsigned m_junks = 0;
+	unsigned m_stalls = 0;
+};
+
+faulty::faulty(const io::sp& io, const string& spec)
+: m_io(io), m_dist(0.0, 1.0)
+{
+	for (string arg : split(spec, ',', false)) {
+		auto tok = split(arg, '=');
+		if (tok.size() != 2) {
+			throw user_error("invalid fault specification: '" + arg + "'");
+		}
+
+		if (tok[0] == "seed") {
+			m_rng.seed(lexical_cast<unsigned>(tok[1]));
+			continue;
+		}
+
+		double p = stod(tok[1]);
+		if (tok[0] == "drop") {
+			m_p_drop = p;
+		} else if (tok[0] == "flip") {
+			m_p_flip = p;
+		} else if (tok[0] == "junk") {
+			m_p_junk = p;
+		} else if (tok[0] == "stall") {
+			m_p_stall = p;
+		} else if (tok[0] == "disconnect") {
+			m_p_disconnect = p;
+		} else {
+			throw user_error("invalid fault type: '" + tok[0] + "'");
+		}
+	}
+}
+
+faulty::~faulty()
+{
+	logger::i() << endl << "injected faults: " << m_drops << " dropped, " << m_flips << " flipped, "
+			<< m_junks << " junk lines, " << m_stalls << " stalls"
+			<< (m_disconnected ? ", disconnected" : "") << endl;
+}
+
+void faulty::check_connected()
+{
+	if (!m_disconnected && roll(m_p_disconnect)) {
+		m_disconnected = true;
+	}
+
+	if (m_disconnected) {
+		throw errno_error("faulty", ECONNRESET);
+	}
+}
+
+int faulty::mangle(int c)
+{
+	if (c == eof || c == ign) {
+		return c;
+	} else if (roll(m_p_drop)) {
+		++m_drops;
+		return ign;
+	} else if (isxdigit(c) && roll(m_p_flip)) {
+		++m_flips;
+		int n = (isdigit(c) ? c - '0' : (tolower(c) - 'a' + 10)) ^ (1 << (m_rng() % 4));
+		c = isupper(c) ? toupper(to_hex(n, 1)[0]) : to_hex(n, 1)[0];
+	}
+
+	if (c == '\n' && roll(m_p_junk)) {
+		++m_junks;
+		m_junk = "[00:00:00 01/01/1970] Fault injection: stray log message\r\n";
+	}
+
+	return c;
+}
+
+int faulty::getc()
+{
+	check_connected();
+
+	if (!m_junk.empty()) {
+		int c = m_junk[0] & 0xff;
+		m_junk.erase(0, 1);
+		return c;
+	}
+
+	return mangle(m_io->getc());
+}
+
+string faulty::read(size_t length, bool all)
+{
+	check_connected();
+
+	string buf;
+
+	// dropped bytes must be made up for, if all <length> bytes were requested
+	do {
+		for (char c : m_io->read(length - buf.size(), all)) {
+			int m = mangle(c & 0xff);
+			if (m != ign) {
+				buf += char(m);
+			}
+		}
+	} while (all && buf.size() < length);
+
+	return buf;
+}
+
+void faulty::writeln(const string& str)
+{
+	check_connected();
+	m_io->writeln(str);
+}
+
+void faulty::write(const string& str)
+{
+	check_connected();
+	m_io->write(str);
+}
+
+bool faulty::pending(unsigned timeout)
+{
+	check_connected();
+
+	if (!m_junk.empty()) {
+		return true;
+	} else if (roll(m_p_stall)) {
+		++m_stalls;
+		this_thread::sleep_for(chrono::milliseconds(timeout));
+		return false;
+	}
+
+	return m_io->pending(timeout);
+}
+}
+
+string io::s_record_file;
+string io::s_fault_spec;
+
 string io::readln(unsigned timeout)
 {
 	string line;
@@ -582,12 +1358,12 @@ string io::readln(unsigned timeout)
 
 	if (!line.empty()) {
 #ifdef DEBUG
-		add_line("'" + line + "'", true);
+		add_line(line, true);
 #endif
 		return line;
 	} else if (lf) {
 #ifdef DEBUG
-		add_line("(empty)", true);
+		add_line("", true);
 #endif
 	}
 
@@ -596,21 +1372,48 @@ string io::readln(unsigned timeout)
 
 shared_ptr<io> io::open_serial(const char* tty, unsigned speed)
 {
-	return make_shared<serial>(tty, speed);	
+	return decorate(make_shared<serial>(tty, speed));
 }
 
 shared_ptr<io> io::open_telnet(const string& address, unsigned short port)
 {
-	return make_shared<telnet>(address, port);
+	return decorate(make_shared<telnet>(address, port));
 }
 
 shared_ptr<io> io::open_tcp(const string& address, unsigned short port)
 {
-	return make_shared<tcp>(address, port);
+	return decorate(make_shared<tcp>(address, port));
+}
+
+shared_ptr<io> io::open_replay(const string& filename, bool realtime)
+{
+	return make_shared<replay>(filename, realtime);
+}
+
+shared_ptr<io> io::decorate(const shared_ptr<io>& io)
+{
+	shared_ptr<bcm2dump::io> ret = io;
+
+	if (!s_fault_spec.empty()) {
+		ret = make_shared<faulty>(ret, s_fault_spec);
+	}
+
+	if (!s_record_file.empty()) {
+		ret = make_shared<recorder>(ret, s_record_file);
+	}
+
+	return ret;
 }
 
 list<string> io::get_last_lines()
 {
-	return lines;
+	const size_t size = sizeof(history) / sizeof(history[0]);
+	list<string> ret;
+
+	for (size_t i = history_count > size ? history_count - size : 0; i < history_count; ++i) {
+		ret.push_back(format_line(history[i % size].data, history[i % size].in));
+	}
+
+	return ret;
 }
 }
@@ -19,6 +19,7 @@
 
 #ifndef BCM2DUMP_IO_H
 #define BCM2DUMP_IO_H
+#include <chrono>
 #include <memory>
 #include <string>
 #include <list>
@@ -44,11 +45,36 @@ class io
 
 	virtual bool pending(unsigned timeout = 100) = 0;
 
+	// time at which the most recently read byte was received. this may be
+	// earlier than the time at which it was read, if the data is buffered.
+	virtual std::chrono::steady_clock::time_point last_arrival()
+	{ return std::chrono::steady_clock::now(); }
+
 	static sp open_serial(const char* tty, unsigned speed);
 	static sp open_telnet(const std::string& address, uint16_t port);
 	static sp open_tcp(const std::string& address, uint16_t port);
+	// replays a session recorded using record_to(). if realtime is
+	// false, data is made available as fast as possible.
+	static sp open_replay(const std::string& filename, bool realtime = false);
+
+	// record all subsequently opened sessions to the given file
+	static void record_to(const std::string& filename)
+	{ s_record_file = filename; }
+
+	// inject faults into all subsequently opened sessions. spec is a
+	// comma separated list of <fault>=<probability>, with <fault> being
+	// one of drop, flip, junk, stall or disconnect. seed=<n> sets the
+	// seed of the random number generator.
+	static void inject_faults(const std::string& spec)
+	{ s_fault_spec = spec; }
 
 	static std::list<std::string> get_last_lines();
+
+	private:
+	static sp decorate(const sp& io);
+
+	static std::string s_record_file;
+	static std::string s_fault_spec;
 };
 }
 
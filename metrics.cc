@@ -0,0 +1,147 @@
+/**
+ * bcm2-utils
+ * Copyright (C) 2016 Joseph Lehner <joseph.c.lehner@gmail.com>
+ *
+ * bcm2-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bcm2-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bcm2-utils.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include "metrics.h"
+using namespace std;
+
+namespace bcm2dump {
+namespace {
+
+mutex s_mutex;
+// std::map, so that metrics are reported in order. its elements are
+// never moved, so counter handles remain valid.
+map<string, atomic<uint64_t>> s_counters;
+map<string, metrics::histogram> s_histograms;
+
+string millis(uint64_t usecs)
+{
+	ostringstream ostr;
+	ostr << fixed << setprecision(1) << (usecs / 1000.0);
+	return ostr.str();
+}
+}
+
+constexpr unsigned metrics::histogram::buckets;
+
+void metrics::histogram::add(uint64_t usecs)
+{
+	unsigned i = 0;
+	while (usecs >> i && i < (buckets - 1)) {
+		++i;
+	}
+
+	++counts[i];
+	min = count ? std::min(min, usecs) : usecs;
+	max = std::max(max, usecs);
+	sum += usecs;
+	++count;
+}
+
+uint64_t metrics::histogram::percentile(double p) const
+{
+	uint64_t n = 0;
+
+	for (unsigned i = 0; i < buckets; ++i) {
+		n += counts[i];
+		if (n && n >= p * count) {
+			return std::min(max, (uint64_t(1) << i) - 1);
+		}
+	}
+
+	return max;
+}
+
+void metrics::count(const string& name, uint64_t n)
+{
+	get_counter(name).fetch_add(n, memory_order_relaxed);
+}
+
+void metrics::time(const string& name, uint64_t usecs)
+{
+	lock_guard<mutex> lock(s_mutex);
+	s_histograms[name].add(usecs);
+}
+
+atomic<uint64_t>& metrics::get_counter(const string& name)
+{
+	lock_guard<mutex> lock(s_mutex);
+	return s_counters[name];
+}
+
+void metrics::print_summary(ostream& os)
+{
+	lock_guard<mutex> lock(s_mutex);
+
+	for (auto& c : s_counters) {
+		os << setfill(' ') << left << setw(28) << c.first << right << setw(12) << c.second.load() << endl;
+	}
+
+	for (auto& h : s_histograms) {
+		const histogram& hg = h.second;
+		os << setfill(' ') << left << setw(28) << h.first << right << setw(12) << hg.count << " x, avg "
+				<< millis(hg.sum / hg.count) << " ms, p50 " << millis(hg.percentile(0.5)) << " ms, p99 "
+				<< millis(hg.percentile(0.99)) << " ms, max " << millis(hg.max) << " ms, total "
+				<< millis(hg.sum) << " ms" << endl;
+	}
+}
+
+void metrics::write_json(ostream& os)
+{
+	lock_guard<mutex> lock(s_mutex);
+
+	os << "{" << endl << "  \"counters\": {";
+
+	bool first = true;
+	for (auto& c : s_counters) {
+		os << (first ? "" : ",") << endl << "    \"" << c.first << "\": " << c.second.load();
+		first = false;
+	}
+
+	os << endl << "  }," << endl << "  \"histograms\": {";
+
+	first = true;
+	for (auto& h : s_histograms) {
+		const histogram& hg = h.second;
+		os << (first ? "" : ",") << endl << "    \"" << h.first << "\": {"
+				<< "\"count\": " << hg.count << ", \"sum_us\": " << hg.sum
+				<< ", \"min_us\": " << hg.min << ", \"max_us\": " << hg.max
+				<< ", \"p50_us\": " << hg.percentile(0.5) << ", \"p90_us\": " << hg.percentile(0.9)
+				<< ", \"p99_us\": " << hg.percentile(0.99) << ", \"buckets\": [";
+
+		// trailing empty buckets are omitted
+		unsigned last = histogram::buckets;
+		while (last && !hg.counts[last - 1]) {
+			--last;
+		}
+
+		for (unsigned i = 0; i < last; ++i) {
+			os << (i ? ", " : "") << hg.counts[i];
+		}
+
+		os << "]}";
+		first = false;
+	}
+
+	os << endl << "  }" << endl << "}" << endl;
+}
+}
@@ -0,0 +1,98 @@
+/**
+ * bcm2-utils
+ * Copyright (C) 2016 Joseph Lehner <joseph.c.lehner@gmail.com>
+ *
+ * bcm2-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bcm2-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bcm2-utils.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef BCM2DUMP_METRICS_H
+#define BCM2DUMP_METRICS_H
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace bcm2dump {
+
+// process-wide counters and latency histograms, which are reported at
+// exit. all functions are thread-safe.
+class metrics
+{
+	public:
+	// latencies are recorded in microseconds. bucket i counts values
+	// in [2^(i-1), 2^i), with bucket 0 counting zeroes.
+	struct histogram
+	{
+		static constexpr unsigned buckets = 32;
+
+		uint64_t count = 0;
+		uint64_t sum = 0;
+		uint64_t min = 0;
+		uint64_t max = 0;
+		uint64_t counts[buckets] = { 0 };
+
+		void add(uint64_t usecs);
+		// upper bound of the bucket containing the given percentile
+		uint64_t percentile(double p) const;
+	};
+
+	// measures the time until it is destroyed
+	class timer
+	{
+		public:
+		timer(const std::string& name)
+		: m_name(name), m_start(std::chrono::steady_clock::now()) {}
+		~timer()
+		{ metrics::time(m_name, m_start); }
+
+		private:
+		std::string m_name;
+		std::chrono::steady_clock::time_point m_start;
+	};
+
+	// a counter that is only looked up once, for use on hot paths,
+	// where count() would be too expensive:
+	//
+	// static metrics::counter bytes("io.bytes");
+	// bytes.add(n);
+	class counter
+	{
+		public:
+		counter(const std::string& name)
+		: m_value(metrics::get_counter(name)) {}
+
+		void add(uint64_t n = 1)
+		{ m_value.fetch_add(n, std::memory_order_relaxed); }
+
+		private:
+		std::atomic<uint64_t>& m_value;
+	};
+
+	static void count(const std::string& name, uint64_t n = 1);
+	static void time(const std::string& name, uint64_t usecs);
+	static void time(const std::string& name, std::chrono::steady_clock::time_point start)
+	{ time(name, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count()); }
+
+	// human readable summary, one line per metric
+	static void print_summary(std::ostream& os);
+	static void write_json(std::ostream& os);
+
+	private:
+	static std::atomic<uint64_t>& get_counter(const std::string& name);
+};
+}
+
+#endif
@@ -76,6 +76,7 @@
 #define S3 S(3)
 #define S4 S(4)
 #define S5 S(5)
+#define S6 S(6)
 #define S7 S(7)
 
 #define ADDIU(rt, rs, imm)   ASM_I(0x09, rs, rt, imm)
@@ -95,11 +96,13 @@
 #define JALR(rs)             ASM_R(rs, 0, RA, 0, 0x09)
 #define JR(rs)               ASM_R(rs, 0, 0, 0, 0x08)
 #define LB(rt, imm, rs)      ASM_I(0x20, rs, rt, imm)
+#define LBU(rt, imm, rs)     ASM_I(0x24, rs, rt, imm)
 #define LUI(rt, imm)         ASM_I(0x0f, 0, rt, imm)
 #define LI(rt, imm32)        LUI(rt, ASM_HI(imm32)), ORI(rt, rt, ASM_LO(imm32))
 #define LW(rt, imm, rs)      ASM_I(0x23, rs, rt, imm)
 #define MOVE(rt, rs)         ADDU(rt, rs, ZERO)
 #define NOP                  0x00000000
+#define NOR(rd, rs, rt)      ASM_R(rs, rt, rd, 0, 0x27)
 #define SLL(rd, rt, sa)      ASM_R(0, rt, rd, sa, 0x00)
 #define SRL(rd, rt, sa)      ASM_R(0, rt, rd, sa, 0x02)
 #define OR(rd, rs, rt)       ASM_R(rs, rt, rd, 0, 0x25)
@@ -109,6 +112,7 @@
 #define SUBU(rd, rs, rt)     ASM_R(rs, rt, rd, 0, 0x23)
 #define SB(rt, imm, rs)      ASM_I(0x28, rs, rt, imm)
 #define SW(rt, imm, rs)      ASM_I(0x2b, rs, rt, imm)
+#define XOR(rd, rs, rt)      ASM_R(rs, rt, rd, 0, 0x26)
 
 #define BAL(target)          BGEZAL(ZERO, target)
 #define BGEZAL(rs, target)   ASM_I(0x01, rs, 0x11, target)
@@ -18,7 +18,10 @@
  */
 
 #include <iostream>
+#include <cstring>
 #include <string>
+#include <mutex>
+#include <tuple>
 #include <set>
 #include "nonvol2.h"
 #include "util.h"
@@ -27,6 +30,10 @@ using namespace bcm2dump;
 
 namespace bcm2cfg {
 namespace {
+
+// see nv_arena::scope
+thread_local nv_arena* current_arena = nullptr;
+
 std::string desc(const nv_val::named& var)
 {
 	return var.name + " (" + var.val->type() + ")";
@@ -86,11 +93,9 @@ string data_to_string(const string& data, unsigned level, bool pretty)
 	}
 
 	for (size_t i = 0; i < data.size(); ++i) {
-		if (!(i % threshold)) {
-			if (multiline) {
-				ostr << endl << pad(level) << "0x" << to_hex(i, 3) << " = ";
-			}
-		} else {
+		if (multiline && !(i % threshold)) {
+			ostr << endl << pad(level) << "0x" << to_hex(i, 3) << " = ";
+		} else if (i) {
 			ostr << ':';
 		}
 
@@ -208,6 +213,116 @@ bool is_valid_identifier(const std::string& name)
 
 	return true;
 }
+
+// assigns names to unnamed members, and checks that all names are valid
+void validate_names(nv_val::list& parts)
+{
+	set<string> names;
+	unsigned unk = 0;
+
+	for (auto& v : parts) {
+		if (v.name.empty()) {
+			v.name = "_unk_" + std::to_string(++unk);
+		}
+	}
+
+	for (auto& v : parts) {
+		if (!names.insert(v.name).second) {
+			throw runtime_error("redefinition of member " + v.name);
+		} else if (!is_valid_identifier(v.name)) {
+			throw runtime_error("invalid identifier name " + v.name);
+		}
+	}
+}
+
+// replaces all values with copies
+bool copy_values(nv_val::list& parts)
+{
+	for (auto& v : parts) {
+		v.val = v.val->copy();
+		if (!v.val) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// fnv-1a
+size_t name_hash(const char* name, size_t len)
+{
+	size_t hash = 14695981039346656037ULL;
+
+	for (size_t i = 0; i < len; ++i) {
+		hash = (hash ^ static_cast<unsigned char>(name[i])) * 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+// set by nv_group::definition(int, const nv_version&), whose result
+// depends on the group's size
+thread_local bool sized_definition = false;
+}
+
+constexpr size_t nv_arena::min_block_size;
+constexpr size_t nv_arena::max_block_size;
+
+nv_arena::~nv_arena()
+{
+	for (char* block : m_blocks) {
+		delete[] block;
+	}
+}
+
+void* nv_arena::allocate(size_t size, size_t align)
+{
+	size_t pad = (align - reinterpret_cast<uintptr_t>(m_pos) % align) % align;
+
+	if (!m_pos || size + pad > size_t(m_end - m_pos)) {
+		// most groups are small, so start with a small block, and
+		// double the size of each new one, up to max_block_size. the
+		// blocks of large values don't count, as they may come first.
+		size_t block_size = m_block_size ? min(2 * m_block_size, max_block_size) : min_block_size;
+
+		// large values get a block of their own, so as not to waste the
+		// remainder of the current block.
+		if (size > block_size / 4) {
+			m_blocks.push_back(new char[size]);
+			return m_blocks.back();
+		}
+
+		m_blocks.push_back(new char[block_size]);
+		m_block_size = block_size;
+		m_pos = m_blocks.back();
+		m_end = m_pos + block_size;
+		pad = 0;
+	}
+
+	void* ret = m_pos + pad;
+	m_pos += pad + size;
+	return ret;
+}
+
+nv_arena::scope::scope()
+: m_owner(!current_arena)
+{
+	if (m_owner) {
+		current_arena = new nv_arena();
+	}
+}
+
+nv_arena::scope::~scope()
+{
+	if (m_owner) {
+		current_arena->unref();
+		current_arena = nullptr;
+	}
+}
+
+nv_arena* nv_arena::current()
+{
+	return current_arena;
 }
 
 csp<nv_val> nv_val::get(const string& name) const
@@ -220,6 +335,16 @@ void nv_val::set(const string& name, const string& val)
 	throw runtime_error("requested member '" + name + "' of non-compound type " + type());
 }
 
+sp<nv_val> nv_val::copy() const
+{
+	if (!m_copy) {
+		return nullptr;
+	}
+
+	sp<nv_val> ret = m_copy(*this);
+	return ret->copied() ? ret : nullptr;
+}
+
 nv_val& nv_val::parse_checked(const std::string& str)
 {
 	if (!parse(str)) {
@@ -229,6 +354,16 @@ nv_val& nv_val::parse_checked(const std::string& str)
 	return *this;
 }
 
+nv_path::nv_path(const string& path)
+: m_str(path)
+{
+	for (auto& name : split(path, '.', false)) {
+		m_components.push_back({ name, name_hash(name.data(), name.size()) });
+	}
+}
+
+const nv_val::list nv_compound::s_no_parts;
+
 bool nv_compound::parse(const string& str)
 {
 	throw invalid_argument("cannot directly set value of compound type " + type());
@@ -244,13 +379,32 @@ csp<nv_val> nv_compound::get(const string& name) const
 	return val;
 }
 
+csp<nv_val> nv_compound::get(const nv_path& path) const
+{
+	auto val = find(path);
+	if (!val) {
+		throw invalid_argument("requested non-existing member '" + path.str() + "' of type " + type());
+	}
+
+	return val;
+}
+
 void nv_compound::set(const string& name, const string& val)
 {
-	sp<nv_val> v = const_pointer_cast<nv_val>(get(name));
+	assign(const_pointer_cast<nv_val>(get(name)), name, val);
+}
+
+void nv_compound::set(const nv_path& path, const string& val)
+{
+	assign(const_pointer_cast<nv_val>(get(path)), path.str(), val);
+}
+
+void nv_compound::assign(const sp<nv_val>& v, const string& name, const string& val)
+{
 	if (!v->is_set()) {
 		string preceding_unset_name;
 
-		for (auto p : parts()) {
+		for (auto& p : parts()) {
 			if (!p.val->is_disabled()) {
 				if (p.name == name) {
 					break;
@@ -270,63 +424,197 @@ void nv_compound::set(const string& name, const string& val)
 		}
 	}
 
-	ssize_t diff = get(name)->bytes();
+	ssize_t diff = v->bytes();
 	diff -= v->parse_checked(val).bytes();
 	m_bytes += diff;
 }
 
 csp<nv_val> nv_compound::find(const string& name) const
 {
-	vector<string> tok = split(name, '.', false, 2);
+	// names with escaped dots are rare, so they take the slow path
+	if (name.find('\\') != string::npos) {
+		return find(nv_path(name));
+	}
 
-	for (auto c : parts()) {
-		if (c.val->is_disabled()) {
-			continue;
-		} else if (c.name == tok[0]) {
-			if (tok.size() == 2 && c.val->is_compound()) {
-				return nv_val_cast<nv_compound>(c.val)->find(tok[1]);
+	const nv_compound* c = this;
+	size_t beg = name.find_first_not_of('.');
+
+	while (beg != string::npos) {
+		size_t end = min(name.find('.', beg), name.size());
+		auto p = c->find_part(&name[beg], end - beg, name_hash(&name[beg], end - beg));
+		beg = name.find_first_not_of('.', end);
+
+		if (!p) {
+			return nullptr;
+		} else if (beg == string::npos || !p->val->is_compound()) {
+			return p->val;
+		}
+
+		c = static_cast<const nv_compound*>(p->val.get());
+	}
+
+	return nullptr;
+}
+
+csp<nv_val> nv_compound::find(const nv_path& path) const
+{
+	const nv_compound* c = this;
+	auto& comps = path.m_components;
+
+	for (size_t i = 0; i < comps.size(); ++i) {
+		auto p = c->find_part(comps[i].name.data(), comps[i].name.size(), comps[i].hash);
+		if (!p) {
+			return nullptr;
+		} else if ((i + 1) == comps.size() || !p->val->is_compound()) {
+			return p->val;
+		}
+
+		c = static_cast<const nv_compound*>(p->val.get());
+	}
+
+	return nullptr;
+}
+
+const nv_val::named* nv_compound::find_part(const char* name, size_t len, size_t hash) const
+{
+	const list& parts = this->parts();
+
+	// small compounds are faster to scan
+	if (parts.size() <= 8) {
+		for (auto& p : parts) {
+			if (!p.val->is_disabled() && p.name.size() == len && !memcmp(p.name.data(), name, len)) {
+				return &p;
 			}
-			return c.val;
+		}
+
+		return nullptr;
+	}
+
+	if (m_indexed != parts.size()) {
+		update_index(parts);
+	}
+
+	size_t mask = m_index.size() - 1;
+
+	for (size_t i = hash & mask; m_index[i]; i = (i + 1) & mask) {
+		const named& p = parts[m_index[i] - 1];
+		if (p.name.size() == len && !memcmp(p.name.data(), name, len)) {
+			return &p;
 		}
 	}
 
 	return nullptr;
 }
 
+void nv_compound::update_index(const list& parts) const
+{
+	// start over if parts were removed, or if the table is more than half full
+	if (m_indexed > parts.size() || (parts.size() * 2) > m_index.size()) {
+		size_t size = 16;
+		while (size < (parts.size() * 2)) {
+			size *= 2;
+		}
+
+		m_index.assign(size, 0);
+		m_indexed = 0;
+	}
+
+	size_t mask = m_index.size() - 1;
+
+	for (; m_indexed < parts.size(); ++m_indexed) {
+		const named& p = parts[m_indexed];
+		if (p.val->is_disabled()) {
+			continue;
+		}
+
+		size_t i = name_hash(p.name.data(), p.name.size()) & mask;
+
+		// only the first of several members with the same name can be found
+		while (m_index[i] && parts[m_index[i] - 1].name != p.name) {
+			i = (i + 1) & mask;
+		}
+
+		if (!m_index[i]) {
+			m_index[i] = m_indexed + 1;
+		}
+	}
+}
+
+void nv_compound::invalidate_index()
+{
+	m_index.clear();
+	m_indexed = 0;
+}
+
 bool nv_compound::init(bool force)
 {
 	if (m_parts.empty() || force) {
 		m_parts = definition();
 		//m_bytes = 0;
 		m_set = false;
+		m_fresh = m_shared = false;
+		invalidate_index();
 		return true;
 	}
 
 	return false;
 }
 
-istream& nv_compound::read(istream& is)
+bool nv_compound::copied()
+{
+	if (m_fresh) {
+		m_shared = true;
+		return true;
+	}
+
+	return copy_values(m_parts);
+}
+
+bool nv_compound::prepare()
 {
 	clear();
+	m_fresh = true;
+	return prepare(m_parts);
+}
 
-	std::set<string> names;
-	unsigned unk = 0;
+bool nv_compound::prepare(list& parts)
+{
+	validate_names(parts);
 
-	// do this for all parts, regardless of whether they
-	// are found in the config file
-	for (auto& v : m_parts) {
-		if (v.name.empty()) {
-			v.name = "_unk_" + std::to_string(++unk);
+	for (auto& v : parts) {
+		if (v.val->is_compound() && !nv_val_cast<nv_compound>(v.val)->prepare()) {
+			return false;
+		} else if (!v.val->copy()) {
+			return false;
 		}
 	}
 
+	return true;
+}
+
+istream& nv_compound::read(istream& is)
+{
+	if (m_fresh) {
+		if (m_shared && !copy_values(m_parts)) {
+			// prepare() has made sure that this doesn't happen
+			throw runtime_error("failed to copy definition of " + type());
+		}
+		m_shared = false;
+	} else {
+		clear();
+		// clear() may have instantiated a prepared definition
+		if (!m_fresh) {
+			// do this for all parts, regardless of whether they
+			// are found in the config file
+			validate_names(m_parts);
+		}
+	}
+
+	m_fresh = false;
+
 	for (auto& v : m_parts) {
-		if (!names.insert(v.name).second) {
-			throw runtime_error("redefinition of member " + v.name);
-		} else if (!is_valid_identifier(v.name)) {
-			throw runtime_error("invalid identifier name " + v.name);
-		} else if (v.val->is_disabled()) {
-			logger::d() << "skipping disabled " << desc(v) << endl;
+		if (v.val->is_disabled()) {
+			LOG_D << "skipping disabled " << desc(v) << endl;
 			continue;
 		}
 
@@ -335,7 +623,7 @@ istream& nv_compound::read(istream& is)
 				if (!m_partial) {
 					throw runtime_error("pos " + ::to_string(m_bytes) + ": failed to read " + desc(v));
 				} else {
-					logger::d() << "pos " << m_bytes << ": stopped parsing at " << desc(v) << ", stream=" << !!is
+					LOG_D << "pos " << m_bytes << ": stopped parsing at " << desc(v) << ", stream=" << !!is
 							<< " width=" << m_width << " bytes=" << m_bytes << " val=" << v.val->bytes() << " bytes" << endl;
 				}
 				break;
@@ -344,10 +632,10 @@ istream& nv_compound::read(istream& is)
 				// check again, because a successful read may have changed the
 				// byte count (e.g. an nv_pstring)
 				if ((m_width && m_bytes + v.val->bytes() > m_width)) {
-					logger::d() << v.val->bytes() << endl;
+					LOG_D << v.val->bytes() << endl;
 					throw runtime_error("pos " + ::to_string(m_bytes) + ": variable ends outside of group: " + desc(v));
 				}
-				logger::d() << "pos " << m_bytes  << ": " + desc(v) << " = " << v.val->to_pretty() << " (" << v.val->bytes() << " b)"<< endl;
+				LOG_D << "pos " << m_bytes << ": " << desc(v) << " = " << v.val->to_pretty() << " (" << v.val->bytes() << " b)"<< endl;
 				m_bytes += v.val->bytes();
 				m_set = true;
 
@@ -372,23 +660,23 @@ ostream& nv_compound::write(ostream& os) const
 	size_t pos = 0;
 
 	for (auto v : parts()) {
-		logger::d() << "pos " << pos << ": ";
+		LOG_D << "pos " << pos << ": ";
 		if (v.val->is_disabled()) {
-			logger::d() << v.name << " (disabled)" << endl;
+			LOG_D << v.name << " (disabled)" << endl;
 			continue;
 		} else if (!v.val->is_set()) {
 			if (m_partial) {
-				logger::d() << v.name << " (unset)" << endl;
+				LOG_D << v.name << " (unset)" << endl;
 				continue;
 			}
-			logger::d() << "writing unset " << name() << "." << v.name << endl;
+			LOG_D << "writing unset " << name() << "." << v.name << endl;
 		}
 
 		if (!v.val->write(os)) {
 			throw runtime_error("failed to write " + desc(v));
 		}
 
-		logger::d() << desc(v) << " = " << v.val->to_pretty() << endl;
+		LOG_D << desc(v) << " = " << v.val->to_pretty() << endl;
 		pos += v.val->bytes();
 	}
 
@@ -404,6 +692,11 @@ std::string nv_compound::to_string(unsigned level, bool pretty) const
 	return compound_to_string(*this, level, pretty, name());
 }
 
+bool nv_compound_def::copied()
+{
+	return copy_values(m_def) && nv_compound::copied();
+}
+
 std::string nv_array_base::to_string(unsigned level, bool pretty) const
 {
 	return compound_to_string(*this, level, pretty, name(), m_is_end);
@@ -660,13 +953,26 @@ nv_group::nv_group(const nv_magic& magic, const std::string& name)
 
 bool nv_group::init(bool force)
 {
-	if (nv_compound::init(force)) {
-		m_bytes = is_versioned() ? 8 : 6;
-		m_width = m_size.num();
-		return true;
+	if (!m_parts.empty() && !force) {
+		return false;
 	}
 
-	return false;
+	auto def = cached_definition();
+	if (def) {
+		m_parts = *def;
+		if (!copy_values(m_parts)) {
+			throw runtime_error(type() + ": failed to copy definition");
+		}
+		m_set = false;
+		m_fresh = true;
+		invalidate_index();
+	} else {
+		nv_compound::init(true);
+	}
+
+	m_bytes = is_versioned() ? 8 : 6;
+	m_width = m_size.num();
+	return true;
 }
 
 istream& nv_group::read(istream& is)
@@ -675,20 +981,81 @@ istream& nv_group::read(istream& is)
 		throw runtime_error("failed to read group version");
 	}
 
-	logger::d() << "** " << m_magic.to_str() << " " << m_size.num() << " b, version 0x" << to_hex(m_version.num()) << endl;
+	if (m_lazy) {
+		size_t header = is_versioned() ? 8 : 6;
+		size_t size = m_size.num() > header ? m_size.num() - header : 0;
+
+		auto mem = m_borrow ? dynamic_cast<imemstream*>(&is) : nullptr;
+		if (mem && mem->remaining() >= size) {
+			m_borrowed = mem->take(size);
+			m_borrowed_size = size;
+			m_bytes = m_size.num();
+			return is;
+		}
+
+		m_raw.resize(size);
+		if (is.read(&m_raw[0], m_raw.size())) {
+			m_bytes = m_size.num();
+			return is;
+		}
+
+		// the file is truncated, so we decode whatever we've got, like
+		// a regular read would have done.
+		m_raw.resize(is.gcount());
+		decode();
+		return is;
+	}
+
+	return read_data(is);
+}
+
+const nv_val::list& nv_group::parts() const
+{
+	if (m_lazy) {
+		const_cast<nv_group*>(this)->decode();
+	}
+
+	return nv_compound::parts();
+}
+
+bool nv_group::is_set() const
+{
+	// a group that doesn't contain any values is unset, which isn't
+	// known until it's decoded
+	if (m_lazy) {
+		const_cast<nv_group*>(this)->decode();
+	}
+
+	return nv_compound::is_set();
+}
+
+void nv_group::decode()
+{
+	imemstream istr(m_borrowed ? m_borrowed : m_raw.data(), m_borrowed ? m_borrowed_size : m_raw.size());
+	m_borrowed = nullptr;
+	m_lazy = false;
+	read_data(istr);
+	m_raw.clear();
+	m_raw.shrink_to_fit();
+}
+
+istream& nv_group::read_data(istream& is)
+{
+	nv_arena::scope arena;
+	LOG_D << "** " << m_magic.to_str() << " " << m_size.num() << " b, version 0x" << to_hex(m_version.num()) << endl;
 
 	if (nv_compound::read(is)) {
 		//m_bytes += is_versioned() ? 8 : 6;
 
 		if (m_bytes < m_size.num()) {
-			sp<nv_val> extra = make_shared<nv_data>(m_size.num() - m_bytes);
+			sp<nv_val> extra = nv_make<nv_data>(m_size.num() - m_bytes);
 			if (!extra->read(is)) {
 				throw runtime_error("failed to read remaining " + std::to_string(extra->bytes()) + " bytes");
 			}
 
-			logger::d() << "  read " << m_bytes << " b , group size is " << m_size.num() << "; extra data size is " << extra->bytes() << "b" << endl;
+			LOG_D << "  read " << m_bytes << " b , group size is " << m_size.num() << "; extra data size is " << extra->bytes() << "b" << endl;
 			m_parts.push_back(named("extra", extra));
-			logger::d() << extra->to_pretty() << endl;
+			LOG_D << extra->to_pretty() << endl;
 			m_bytes += extra->bytes();
 		}
 	} else {
@@ -711,6 +1078,13 @@ ostream& nv_group::write(ostream& os) const
 		return os;
 	}
 
+	if (m_lazy) {
+		if (m_borrowed) {
+			return os.write(m_borrowed, m_borrowed_size);
+		}
+		return os.write(m_raw.data(), m_raw.size());
+	}
+
 	return nv_compound::write(os);
 }
 
@@ -721,14 +1095,51 @@ nv_val::list nv_group::definition() const
 
 nv_val::list nv_group::definition(int type, const nv_version& ver) const
 {
+	sized_definition = true;
 	uint16_t size = m_size.num() - (is_versioned() ? 8 : 6);
 	if (size) {
-		return {{ "data", std::make_shared<nv_data>(size) }};
+		return {{ "data", nv_make<nv_data>(size) }};
 	}
 
 	return {};
 }
 
+csp<nv_val::list> nv_group::cached_definition() const
+{
+	static mutex mtx;
+	static map<tuple<uint32_t, int, uint16_t>, csp<list>> cache;
+
+	auto key = make_tuple(m_magic.as_num(), m_type, m_version.num());
+	lock_guard<mutex> lock(mtx);
+
+	auto it = cache.find(key);
+	if (it != cache.end()) {
+		return it->second;
+	}
+
+	// the cached definition outlives any arena
+	nv_arena* arena = current_arena;
+	current_arena = nullptr;
+	sized_definition = false;
+
+	csp<list> ret;
+
+	try {
+		auto def = make_shared<list>(definition(m_type, m_version));
+
+		if (prepare(*def) && !sized_definition) {
+			ret = def;
+		}
+	} catch (...) {
+		current_arena = arena;
+		throw;
+	}
+
+	current_arena = arena;
+	cache[key] = ret;
+	return ret;
+}
+
 map<nv_magic, csp<nv_group>> nv_group::s_registry;
 
 void nv_group::registry_add(const csp<nv_group>& group)
@@ -736,7 +1147,7 @@ void nv_group::registry_add(const csp<nv_group>& group)
 	s_registry[group->m_magic] = group;
 }
 
-istream& nv_group::read(istream& is, sp<nv_group>& group, int type, size_t maxsize)
+istream& nv_group::read(istream& is, sp<nv_group>& group, int type, size_t maxsize, bool lazy, bool borrow)
 {
 	nv_u16 size;
 	nv_magic magic;
@@ -760,6 +1171,8 @@ istream& nv_group::read(istream& is, sp<nv_group>& group, int type, size_t maxsi
 	group->m_size = size;
 	group->m_magic = magic;
 	group->m_type = type;
+	group->m_lazy = lazy;
+	group->m_borrow = borrow;
 
 	return group->read(is);
 }
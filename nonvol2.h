@@ -21,10 +21,13 @@
 #define BCM2CFG_NONVOL_H
 #include <arpa/inet.h>
 #include <iostream>
+#include <atomic>
 #include <limits>
 #include <vector>
 #include <memory>
 #include <string>
+#include <mutex>
+#include <unordered_set>
 #include <map>
 #include "util.h"
 
@@ -60,6 +63,7 @@ template<class T> struct nv_type
 };
 
 template<class To, class From> sp<To> nv_val_cast(const From& from);
+template<class T, class... Args> sp<T> nv_make(Args&&... args);
 
 class nv_val : public serializable
 {
@@ -88,7 +92,7 @@ class nv_val : public serializable
 	virtual bool parse(const std::string& str) = 0;
 	virtual nv_val& parse_checked(const std::string& str) final;
 
-	bool is_set() const
+	virtual bool is_set() const
 	{ return m_set; }
 
 	// when default-constructed, return the minimum byte count
@@ -115,9 +119,23 @@ class nv_val : public serializable
 	friend std::ostream& operator<<(std::ostream& os, const nv_val& val)
 	{ return (os << val.to_pretty()); }
 
+	// returns a deep copy of a value that hasn't been read yet, or nullptr
+	// if that's not possible. only values created by nv_make() can be copied.
+	sp<nv_val> copy() const;
+
 	protected:
+	// called on the result of copy(), to fix up anything that the copy
+	// constructor couldn't. returns false if the copy is unusable.
+	virtual bool copied()
+	{ return true; }
+
 	bool m_disabled = false;
 	bool m_set = false;
+
+	private:
+	template<class T, class... Args> friend sp<T> nv_make(Args&&... args);
+
+	sp<nv_val> (*m_copy)(const nv_val&) = nullptr;
 };
 
 template<class To, class From> sp<To> nv_val_cast(const From& from)
@@ -130,6 +148,146 @@ template<class To, class From> sp<To> nv_val_cast(const From& from)
 	return p;
 }
 
+// values of a group are created in bulk when the group is decoded, and
+// usually live as long as the group itself, so allocating them from an
+// arena is much cheaper than allocating each value separately. the memory
+// of an arena is released once all values allocated from it are gone.
+//
+// an arena must only be used by one thread at a time.
+class nv_arena
+{
+	public:
+	nv_arena(const nv_arena&) = delete;
+	nv_arena& operator=(const nv_arena&) = delete;
+
+	void* allocate(size_t size, size_t align);
+
+	void ref()
+	{ ++m_refs; }
+
+	void unref()
+	{
+		if (!--m_refs) {
+			delete this;
+		}
+	}
+
+	// while in scope, values created using nv_make() in the current
+	// thread are allocated from the same arena. a new arena is created
+	// by the outermost scope.
+	class scope
+	{
+		public:
+		scope();
+		~scope();
+
+		scope(const scope&) = delete;
+		scope& operator=(const scope&) = delete;
+
+		private:
+		bool m_owner;
+	};
+
+	static nv_arena* current();
+
+	// number of blocks allocated so far
+	size_t blocks() const
+	{ return m_blocks.size(); }
+
+	private:
+	nv_arena() {}
+	~nv_arena();
+
+	static constexpr size_t min_block_size = 512;
+	static constexpr size_t max_block_size = 16 * 1024;
+
+	std::atomic<unsigned> m_refs{1};
+	std::vector<char*> m_blocks;
+	size_t m_block_size = 0;
+	char* m_pos = nullptr;
+	char* m_end = nullptr;
+};
+
+template<class T> class nv_arena_allocator
+{
+	public:
+	typedef T value_type;
+
+	explicit nv_arena_allocator(nv_arena* arena) : m_arena(arena)
+	{ m_arena->ref(); }
+
+	nv_arena_allocator(const nv_arena_allocator& other)
+	: nv_arena_allocator(other.m_arena) {}
+
+	template<class U> nv_arena_allocator(const nv_arena_allocator<U>& other)
+	: nv_arena_allocator(other.arena()) {}
+
+	~nv_arena_allocator()
+	{ m_arena->unref(); }
+
+	nv_arena_allocator& operator=(const nv_arena_allocator&) = delete;
+
+	T* allocate(size_t n)
+	{ return static_cast<T*>(m_arena->allocate(n * sizeof(T), alignof(T))); }
+
+	// memory is released along with the arena
+	void deallocate(T*, size_t) {}
+
+	nv_arena* arena() const
+	{ return m_arena; }
+
+	template<class U> bool operator==(const nv_arena_allocator<U>& other) const
+	{ return m_arena == other.arena(); }
+
+	template<class U> bool operator!=(const nv_arena_allocator<U>& other) const
+	{ return m_arena != other.arena(); }
+
+	private:
+	nv_arena* m_arena;
+};
+
+template<class T> sp<nv_val> nv_copy(const nv_val& val)
+{ return nv_make<T>(static_cast<const T&>(val)); }
+
+// like std::make_shared, but uses the current thread's arena, if any. the
+// value can be copied using nv_val::copy().
+template<class T, class... Args> sp<T> nv_make(Args&&... args)
+{
+	sp<T> ret;
+	nv_arena* arena = nv_arena::current();
+	if (arena) {
+		ret = std::allocate_shared<T>(nv_arena_allocator<T>(arena), std::forward<Args>(args)...);
+	} else {
+		ret = std::make_shared<T>(std::forward<Args>(args)...);
+	}
+
+	ret->m_copy = &nv_copy<T>;
+	return ret;
+}
+
+// a member name such as "bcmwifi.wmm.ac_be.sta", split into its components
+// once, so that it can be resolved repeatedly without parsing it again.
+class nv_path
+{
+	public:
+	explicit nv_path(const std::string& path);
+
+	const std::string& str() const
+	{ return m_str; }
+
+	private:
+	friend class nv_compound;
+
+	struct component
+	{
+		std::string name;
+		size_t hash;
+	};
+
+	std::string m_str;
+	std::vector<component> m_components;
+};
+
 // TODO split this into nv_compound and nv_compound_base
 class nv_compound : public nv_val
 {
@@ -149,6 +307,10 @@ class nv_compound : public nv_val
 	// like get, but shouldn't throw
 	virtual csp<nv_val> find(const std::string& name) const;
 
+	csp<nv_val> get(const nv_path& path) const;
+	void set(const nv_path& path, const std::string& val);
+	csp<nv_val> find(const nv_path& path) const;
+
 	virtual bool init(bool force = false);
 	virtual void clear()
 	{ init(true); }
@@ -162,8 +324,10 @@ class nv_compound : public nv_val
 	virtual bool is_compound() const final
 	{ return true; }
 
+	// a compound that hasn't been read has no parts, even if it was
+	// instantiated from a prepared definition
 	virtual const list& parts() const
-	{ return m_parts; }
+	{ return m_fresh ? s_no_parts : m_parts; }
 
 	protected:
 	nv_compound(bool partial, const std::string& name = "")
@@ -171,8 +335,23 @@ class nv_compound : public nv_val
 	nv_compound(bool partial, size_t width, const std::string& name = "")
 	: m_partial(partial), m_width(width), m_name(name) {}
 	virtual list definition() const = 0;
+	virtual bool copied() override;
+
+	// initializes the compound, and all nested ones, and validates the
+	// member names, so that copies can be read without doing that again.
+	// returns false if any of the values can't be copied.
+	bool prepare();
+	static bool prepare(list& parts);
+	// must be called whenever m_parts is replaced
+	void invalidate_index();
 
 	bool m_partial = false;
+	// m_parts is a prepared definition that hasn't been read yet
+	bool m_fresh = false;
+	// the values in m_parts belong to a prepared definition, and are
+	// copied when the compound is read. this way, nested compounds are
+	// only copied if they're actually read.
+	bool m_shared = false;
 	// expected final size
 	size_t m_width = 0;
 	// actual size
@@ -181,7 +360,20 @@ class nv_compound : public nv_val
 	list m_parts;
 
 	private:
+	// returns the first enabled member in parts() called <name>, or nullptr
+	const named* find_part(const char* name, size_t len, size_t hash) const;
+	void update_index(const list& parts) const;
+	void assign(const sp<nv_val>& v, const std::string& name, const std::string& val);
+
+	static const list s_no_parts;
+
 	std::string m_name;
+	// hash table (open addressing) of indexes into parts() (plus one, so
+	// that zero means empty), used by find_part(). it is built lazily, and
+	// extended as parts are added. like parts() of a lazily read group,
+	// this is not thread-safe.
+	mutable std::vector<uint32_t> m_index;
+	mutable size_t m_indexed = 0;
 };
 
 template<> struct nv_type<nv_compound>
@@ -209,6 +401,8 @@ class nv_compound_def final : public nv_compound
 	virtual list definition() const override
 	{ return m_def; }
 
+	virtual bool copied() override;
+
 	private:
 	nv_compound::list m_def;
 };
@@ -252,6 +446,8 @@ template<class T, class I, bool L> class nv_array_generic : public nv_array_base
 				return is;
 			}
 			m_count = bcm2dump::bswapper<I>::ntoh(m_count);
+			// the definition depends on the count
+			m_fresh = false;
 		}
 
 		return nv_compound::read(is);
@@ -277,6 +473,11 @@ template<class T, class I, bool L> class nv_array_generic : public nv_array_base
 		} else {
 			// set any index >= m_count to m_count. this way, we can append the
 			// list using any large index (i.e. list.99 = foo)
+			if (m_fresh) {
+				m_parts.clear();
+				m_fresh = m_shared = false;
+				invalidate_index();
+			}
 			m_parts.push_back({ std::to_string(m_count), std::make_shared<T>()});
 			m_parts.back().val->parse_checked(val);
 			m_count = m_parts.size();
@@ -293,7 +494,7 @@ template<class T, class I, bool L> class nv_array_generic : public nv_array_base
 		list ret;
 
 		for (I i = 0; i < m_count; ++i) {
-			ret.push_back({ std::to_string(i), std::make_shared<T>()});
+			ret.push_back({ std::to_string(i), nv_make<T>()});
 		}
 
 		return ret;
@@ -313,16 +514,24 @@ template<typename T, size_t N = 0> class nv_array : public nv_array_generic<T, s
 	// dynamic_cast can be safely used
 	nv_array(size_t n = N, const is_end_func& is_end = nullptr)
 	: nv_array_generic<T, size_t, false>(n), m_is_end(is_end)
+	{ bind_is_end(); }
+
+	nv_array(const nv_array& other)
+	: nv_array_generic<T, size_t, false>(other), m_is_end(other.m_is_end)
+	{ bind_is_end(); }
+
+	virtual ~nv_array() {}
+
+	private:
+	void bind_is_end()
 	{
-		if (is_end) {
+		if (m_is_end) {
 			nv_array_base::m_is_end = [this] (const csp<nv_val>& val) {
 				return m_is_end(nv_val_cast<const T>(val));
 			};
 		}
 	}
-	virtual ~nv_array() {}
 
-	private:
 	is_end_func m_is_end;
 };
 
@@ -645,20 +854,20 @@ template<typename T> class nv_enum_bitmask : public T
 	virtual ~nv_enum_bitmask() {}
 
 	protected:
-	nv_enum_bitmask(const std::string& name, const valvec& vals) : nv_enum_bitmask(name, vals.size()) { m_vec = vals; }
-	nv_enum_bitmask(const std::string& name, const valmap& vals) : nv_enum_bitmask(name, vals.size()) { m_map = vals; }
-	nv_enum_bitmask(const std::string& name) : nv_enum_bitmask(name, 0) {}
+	nv_enum_bitmask(const std::string& name, valvec vals) : nv_enum_bitmask(name, valmap(), std::move(vals)) {}
+	nv_enum_bitmask(const std::string& name, valmap vals) : nv_enum_bitmask(name, std::move(vals), valvec()) {}
+	nv_enum_bitmask(const std::string& name) : nv_enum_bitmask(name, valmap(), valvec()) {}
 
 	bool str_to_num(const std::string& str, num_type& num, bool bitmask) const
 	{
-		for (num_type i = 0; i < m_vec.size(); ++i) {
-			if (m_vec[i] == str) {
+		for (num_type i = 0; i < m_table->vec.size(); ++i) {
+			if (m_table->vec[i] == str) {
 				num = bitmask ? 1 << i : i;
 				return true;
 			}
 		}
 
-		for (auto v : m_map) {
+		for (auto& v : m_table->map) {
 			if (v.second == str) {
 				num = v.first;
 				return true;
@@ -677,31 +886,79 @@ template<typename T> class nv_enum_bitmask : public T
 	{
 		std::string str;
 
-		if (!m_map.empty()) {
-			auto i = m_map.find(bitmask ? (1 << num) : num);
-			if (i != m_map.end()) {
+		if (!m_table->map.empty()) {
+			auto i = m_table->map.find(bitmask ? (1 << num) : num);
+			if (i != m_table->map.end()) {
 				str = i->second;
 			}
-		} else if (!m_vec.empty() && num < m_vec.size()) {
-			str = m_vec[num];
+		} else if (!m_table->vec.empty() && num < m_table->vec.size()) {
+			str = m_table->vec[num];
 		}
 
 		return str;
 	}
 
-	std::string m_name;
+	const std::string& enum_name() const
+	{ return m_table->name; }
 
 	private:
-	nv_enum_bitmask(const std::string& name, size_t n)
-	: m_name(name)
+	struct table
+	{
+		std::string name;
+		valmap map;
+		valvec vec;
+
+		bool operator==(const table& other) const
+		{ return name == other.name && vec == other.vec && map == other.map; }
+	};
+
+	struct table_hash
+	{
+		size_t operator()(const csp<table>& t) const
+		{
+			std::hash<std::string> hash;
+			size_t ret = hash(t->name);
+
+			for (auto& s : t->vec) {
+				ret = ret * 31 + hash(s);
+			}
+
+			for (auto& v : t->map) {
+				ret = ret * 31 + hash(v.second);
+			}
+
+			return ret;
+		}
+	};
+
+	struct table_equal
+	{
+		bool operator()(const csp<table>& lhs, const csp<table>& rhs) const
+		{ return *lhs == *rhs; }
+	};
+
+	nv_enum_bitmask(const std::string& name, valmap map, valvec vec)
 	{
-		if (n > std::numeric_limits<num_type>::max()) {
+		if (std::max(map.size(), vec.size()) > std::numeric_limits<num_type>::max()) {
 			throw std::invalid_argument("number of enum elements exceeds maximum for " + nv_type<T>::name());
 		}
+
+		m_table = intern({ name, std::move(map), std::move(vec) });
+	}
+
+	// there are only a few distinct tables, but lots of values using
+	// them, so each table is stored only once.
+	static csp<table> intern(table&& t)
+	{
+		static std::mutex mutex;
+		static std::unordered_set<csp<table>, table_hash, table_equal> tables;
+
+		auto p = std::make_shared<const table>(std::move(t));
+		std::lock_guard<std::mutex> lock(mutex);
+		return *tables.insert(p).first;
 	}
 
-	valmap m_map;
-	valvec m_vec;
+	csp<table> m_table;
 };
 
 template<class T> class nv_enum : public nv_enum_bitmask<T>
@@ -713,16 +970,16 @@ template<class T> class nv_enum : public nv_enum_bitmask<T>
 	nv_enum()
 	: super("") {}
 
-	nv_enum(const std::string& name, const typename super::valmap& vals)
-	: super(name, vals) {}
-	nv_enum(const std::string& name, const typename super::valvec& vals)
-	: super(name, vals) {}
+	nv_enum(const std::string& name, typename super::valmap vals)
+	: super(name, std::move(vals)) {}
+	nv_enum(const std::string& name, typename super::valvec vals)
+	: super(name, std::move(vals)) {}
 
 	virtual ~nv_enum() {}
 
 	virtual std::string type() const override
 	{
-		std::string name = super::m_name;
+		std::string name = super::enum_name();
 		return name.empty() ? "enum" : name;
 	}
 
@@ -746,20 +1003,20 @@ template<class T> class nv_bitmask : public nv_enum_bitmask<T>
 	public:
 	nv_bitmask(const std::string& name = "")
 	: super(name) {}
-	nv_bitmask(const typename super::valmap& vals)
-	: super("", vals) {}
-	nv_bitmask(const typename super::valvec& vals)
-	: super("", vals) {}
-	nv_bitmask(const std::string& name, const typename super::valmap& vals)
-	: super(name, vals) {}
-	nv_bitmask(const std::string& name, const typename super::valvec& vals)
-	: super(name, vals) {}
+	nv_bitmask(typename super::valmap vals)
+	: super("", std::move(vals)) {}
+	nv_bitmask(typename super::valvec vals)
+	: super("", std::move(vals)) {}
+	nv_bitmask(const std::string& name, typename super::valmap vals)
+	: super(name, std::move(vals)) {}
+	nv_bitmask(const std::string& name, typename super::valvec vals)
+	: super(name, std::move(vals)) {}
 
 	virtual ~nv_bitmask() {}
 
 	virtual std::string type() const override
 	{
-		std::string name = super::m_name;
+		std::string name = super::enum_name();
 		return name.empty() ? "bitmask" : name;
 	}
 
@@ -889,7 +1146,21 @@ class nv_group : public nv_compound, public cloneable
 
 	virtual std::ostream& write(std::ostream& os) const override;
 
-	static std::istream& read(std::istream& is, sp<nv_group>& group, int type, size_t maxsize);
+	// these decode the group's data first, if it was read lazily
+	virtual const list& parts() const override;
+	virtual bool is_set() const override;
+
+	// reads a group. if <lazy> is true, only the header (size, magic and
+	// version) is parsed; the data is decoded when the group's parts are
+	// first accessed. groups that are never accessed are written back
+	// as-is. note that decoding a lazily read group is not thread-safe,
+	// even though parts() is const.
+	//
+	// if <borrow> is true as well, and <is> is an imemstream, the data
+	// isn't copied, but refers to the stream's buffer, which must then
+	// outlive the group (or at least until it has been decoded).
+	static std::istream& read(std::istream& is, sp<nv_group>& group, int type, size_t maxsize,
+			bool lazy = false, bool borrow = false);
 	static void registry_add(const csp<nv_group>& group);
 	static const auto& registry()
 	{ return s_registry; }
@@ -907,12 +1178,26 @@ class nv_group : public nv_compound, public cloneable
 	protected:
 	virtual list definition() const override final;
 	virtual list definition(int type, const nv_version& ver) const;
+	// returns the prepared definition for this group's magic, type and
+	// version, which is built on first use, or nullptr if the definition
+	// can't be cached.
+	csp<list> cached_definition() const;
 	virtual std::istream& read(std::istream& is) override;
+	// reads everything after the group header
+	std::istream& read_data(std::istream& is);
+	void decode();
 
 	nv_u16 m_size;
 	nv_magic m_magic;
 	nv_version m_version;
 	int m_type = type_unknown;
+	// data of a lazily read group, until it's decoded. if the data was
+	// borrowed, it refers to the input buffer instead of m_raw.
+	bool m_lazy = false;
+	bool m_borrow = false;
+	std::string m_raw;
+	const char* m_borrowed = nullptr;
+	size_t m_borrowed_size = 0;
 
 	private:
 	static std::map<nv_magic, csp<nv_group>> s_registry;
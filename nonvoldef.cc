@@ -21,12 +21,13 @@
 #include "util.h"
 using namespace std;
 
-#define NV_VAR(type, name, ...) { name, make_shared<type>(__VA_ARGS__) }
-#define NV_VARN(type, name, ...) { name, nv_compound_rename(make_shared<type >(__VA_ARGS__), name) }
-#define NV_VAR2(type, name, ...) { name, sp<type>(new type(__VA_ARGS__)) }
-#define NV_VARN2(type, name, ...) { name, nv_compound_rename(sp<type>(new type(__VA_ARGS__)), name) }
-#define NV_VAR3(cond, type, name, ...) { name, nv_val_disable<type>(shared_ptr<type>(new type(__VA_ARGS__)), !(cond)) }
-#define NV_VARN3(cond, type, name, ...) { name, nv_compound_rename(nv_val_disable<type>(shared_ptr<type>(new type(__VA_ARGS__)), !(cond)), name) }
+#define NV_VAR(type, name, ...) { name, nv_make<type>(__VA_ARGS__) }
+#define NV_VARN(type, name, ...) { name, nv_compound_rename(nv_make<type >(__VA_ARGS__), name) }
+// these can be used with brace-enclosed initializer lists, which can't be forwarded
+#define NV_VAR2(type, name, ...) { name, nv_make<type>(type(__VA_ARGS__)) }
+#define NV_VARN2(type, name, ...) { name, nv_compound_rename(nv_make<type>(type(__VA_ARGS__)), name) }
+#define NV_VAR3(cond, type, name, ...) { name, nv_val_disable<type>(nv_make<type>(type(__VA_ARGS__)), !(cond)) }
+#define NV_VARN3(cond, type, name, ...) { name, nv_compound_rename(nv_val_disable<type>(nv_make<type>(type(__VA_ARGS__)), !(cond)), name) }
 
 #define COMMA() ,
 
@@ -18,8 +18,13 @@
  */
 
 #include <iostream>
+#include <future>
+#include <memory>
 #include <string>
+#include <thread>
 #include <vector>
+#include <atomic>
+#include <mutex>
 #include "gwsettings.h"
 #include "nonvol2.h"
 #include "util.h"
@@ -68,18 +73,195 @@ csp<nv_val> get(sp<nv_group> group, const string& name)
 	return nullptr;
 }
 
-int main(int argc, char** argv)
+sp<settings> read_settings(const string& filename, int type, bool lazy)
 {
-	if (argc < 3) {
-		cerr << "usage: nonvoltest <type> <file> {get <name>, set <name> <value>}" << endl;
+	// if possible, the file is mapped, so that it can be parsed without copying it
+	unique_ptr<mapped_file> map;
+	unique_ptr<istream> in;
+
+	try {
+		map.reset(new mapped_file(filename));
+		in.reset(new imemstream(map->data(), map->size()));
+	} catch (const errno_error& e) {
+		in.reset(new ifstream(filename, ios::binary));
+		if (!in->good()) {
+			throw user_error("failed to open " + filename);
+		}
+	}
+
+	return settings::read(*in, type, nullptr, "", lazy);
+}
+
+string csv_escape(const string& str)
+{
+	if (str.find_first_of(",\"\r\n") == string::npos) {
+		return str;
+	}
+
+	string ret = "\"";
+	for (char c : str) {
+		if (c == '"') {
+			ret += '"';
+		}
+		ret += c;
+	}
+
+	return ret + "\"";
+}
+
+// bytes >= 0x80 are escaped as well, as values aren't necessarily valid
+// UTF-8. they're thus read back as latin1 characters.
+string json_escape(const string& str)
+{
+	string ret;
+	for (char c : str) {
+		if (c == '"' || c == '\\') {
+			ret += '\\';
+			ret += c;
+		} else if (c < 0x20 || c & 0x80) {
+			ret += "\\u00" + to_hex(c);
+		} else {
+			ret += c;
+		}
+	}
+
+	return ret;
+}
+
+// returns one line of output. groups are read lazily, so only those
+// that contain any of the requested values are decoded.
+string query_file(const string& filename, int type, const vector<nv_path>& paths, bool json, bool& failed)
+{
+	vector<string> vals(paths.size());
+	vector<bool> found(paths.size());
+	string error;
+
+	try {
+		nv_arena::scope arena;
+		sp<settings> cfg = read_settings(filename, type, true);
+
+		for (size_t i = 0; i < paths.size(); ++i) {
+			// values that are not set are printed as null, or as an
+			// empty field, so they can't be mistaken for real values
+			csp<nv_val> val = cfg->find(paths[i]);
+			if (val && val->is_set()) {
+				// to_pretty() would quote strings, but the to_str() of a
+				// compound is just a placeholder
+				vals[i] = val->is_compound() ? val->to_pretty() : val->to_str();
+				found[i] = true;
+			}
+		}
+	} catch (const exception& e) {
+		error = e.what();
+	}
+
+	failed = !error.empty();
+	string ret;
+
+	if (json) {
+		ret = "{ \"file\": \"" + json_escape(filename) + "\"";
+		for (size_t i = 0; i < paths.size(); ++i) {
+			ret += ", \"" + json_escape(paths[i].str()) + "\": ";
+			ret += found[i] ? "\"" + json_escape(vals[i]) + "\"" : "null";
+		}
+		if (failed) {
+			ret += ", \"error\": \"" + json_escape(error) + "\"";
+		}
+		ret += " }";
+	} else {
+		if (failed) {
+			logger::w() << filename << ": " << error << endl;
+		}
+
+		ret = csv_escape(filename);
+		for (auto& val : vals) {
+			ret += "," + csv_escape(val);
+		}
+	}
+
+	return ret + "\n";
+}
+
+// reads many files using a pool of threads, printing the requested values
+// of each file as CSV or JSON lines, in the order in which the files were
+// specified. without any file arguments, the file names are read from the
+// standard input, one per line.
+int query(int type, const string& format, const string& names, vector<string> files)
+{
+	if (format != "csv" && format != "json") {
+		cerr << "invalid format " << format << endl;
 		return 1;
 	}
 
-	logger::loglevel(logger::verbose);
+	bool json = format == "json";
+	vector<nv_path> paths;
+
+	for (auto& name : split(names, ',', false)) {
+		paths.emplace_back(name);
+	}
+
+	if (files.empty()) {
+		string line;
+		while (getline(cin, line)) {
+			if (!line.empty()) {
+				files.push_back(line);
+			}
+		}
+	}
+
+	if (!json) {
+		cout << "file";
+		for (auto& path : paths) {
+			cout << "," << csv_escape(path.str());
+		}
+		cout << endl;
+	}
+
+	vector<string> lines(files.size());
+	vector<bool> done(files.size());
+	size_t printed = 0;
+	bool failed = false;
+	mutex mtx;
+	atomic<size_t> next{0};
+
+	auto worker = [&] () {
+		for (size_t i = next++; i < files.size(); i = next++) {
+			bool file_failed;
+			string line = query_file(files[i], type, paths, json, file_failed);
+
+			lock_guard<mutex> lock(mtx);
+			lines[i] = move(line);
+			done[i] = true;
+			failed |= file_failed;
+
+			for (; printed < files.size() && done[printed]; ++printed) {
+				cout << lines[printed] << flush;
+				lines[printed].clear();
+				lines[printed].shrink_to_fit();
+			}
+		}
+	};
+
+	unsigned threads = min<size_t>(thread::hardware_concurrency(), files.size());
+	vector<future<void>> workers;
+	for (unsigned i = 1; i < threads; ++i) {
+		workers.push_back(async(launch::async, worker));
+	}
+
+	worker();
+
+	for (auto& w : workers) {
+		w.get();
+	}
+
+	return failed ? 1 : 0;
+}
 
-	ifstream in(argv[2]);
-	if (!in.good()) {
-		cerr << "failed to open " << argv[2] << endl;
+int main(int argc, char** argv)
+{
+	if (argc < 3) {
+		cerr << "usage: nonvoltest <type> <file> {get <name>, set <name> <value>, info}" << endl;
+		cerr << "       nonvoltest <type> query {csv,json} <name>[,<name>...] [<file> ...]" << endl;
 		return 1;
 	}
 
@@ -101,7 +283,28 @@ int main(int argc, char** argv)
 		return 1;
 	}
 
-	sp<settings> cfg = settings::read(in, type, nullptr, "");
+	if (argv[2] == "query"s) {
+		if (argc < 5) {
+			cerr << "usage: nonvoltest <type> query {csv,json} <name>[,<name>...] [<file> ...]" << endl;
+			return 1;
+		}
+
+		return query(type, argv[3], argv[4], vector<string>(argv + 5, argv + argc));
+	}
+
+	logger::loglevel(logger::verbose);
+
+	// info only needs the group headers
+	bool lazy = argc >= 4 && argv[3] == "info"s;
+	sp<settings> cfg;
+
+	try {
+		cfg = read_settings(argv[2], type, lazy);
+	} catch (const user_error& e) {
+		cerr << e.what() << endl;
+		return 1;
+	}
+
 	if (argc >= 5 && argv[3] == "get"s) {
 		csp<nv_val> val = cfg->get(argv[4]);
 		if (val) {
@@ -110,7 +313,6 @@ int main(int argc, char** argv)
 	} else if (argc >= 6 && argv[3] == "set"s) {
 		cfg->set(argv[4], argv[5]);
 		cout << argv[4] << " = " << cfg->get(argv[4])->to_pretty() << endl;
-		in.close();
 		ofstream out(argv[2]);
 		cfg->write(out);
 	} else if (argc >= 4 && argv[3] == "info"s){
@@ -126,9 +328,9 @@ int main(int argc, char** argv)
 	}
 
 #if 0
-	while (in.good()) {
+	while (in->good()) {
 		sp<nv_group> group;
-		if (nv_group::read(in, group, type) || in.eof()) {
+		if (nv_group::read(*in, group, type) || in->eof()) {
 			if (!group || group->magic().to_str() == "ffffffff") {
 				break;
 			}
@@ -358,8 +358,6 @@ func addrspace::get_read_func(bcm2_interface intf) const
 	return func();
 }
 
-vector<profile::sp> profile::s_profiles;
-
 const profile::sp& profile::get(const string& name)
 {
 	for (const profile::sp& p : list()) {
@@ -373,13 +371,17 @@ const profile::sp& profile::get(const string& name)
 
 const vector<profile::sp>& profile::list()
 {
-	if (s_profiles.empty()) {
+	// initialized exactly once, even if this is called from several
+	// threads at once (e.g. when reading settings files in parallel)
+	static const vector<profile::sp> profiles = [] () {
+		vector<profile::sp> ret;
 		for (const bcm2_profile* p = bcm2_profiles; p->name[0]; ++p) {
-			s_profiles.push_back(make_shared<profile_wrapper>(p));
+			ret.push_back(make_shared<profile_wrapper>(p));
 		}
-	}
+		return ret;
+	}();
 
-	return s_profiles;
+	return profiles;
 }
 
 void profile::print_to_stdout(bool verbose) const
@@ -374,10 +374,6 @@ class profile
 
 	static const sp& get(const std::string& name);
 	static const std::vector<profile::sp>& list();
-
-
-	private:
-	static std::vector<profile::sp> s_profiles;
 };
 }
 
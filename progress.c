@@ -17,8 +17,21 @@
  *
  */
 
+#include <math.h>
 #include "bcm2dump.h"
 
+/* minimum time between speed updates, and time constant of the speed
+ * average, both in milliseconds */
+#define PROGRESS_UPDATE_INTERVAL 250
+#define PROGRESS_EWMA_TAU 2000
+
+uint64_t progress_millis(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
 static void gmtime_days(time_t time, unsigned *days, struct tm *tm)
 {
 	*days = time / 86400;
@@ -50,7 +63,8 @@ void progress_init(struct progress *p, unsigned min, unsigned len)
 	memset(p, 0, sizeof(*p));
 
 	p->speed_now = p->speed_avg = 0;
-	p->beg = p->last = time(NULL);
+	p->beg = p->last = progress_millis();
+	p->last_print = 0;
 	p->percentage = 0.0;
 	p->tmp = 0;
 	p->cur = min;
@@ -78,17 +92,24 @@ void progress_add(struct progress *p, unsigned n)
 		p->cur = p->min;
 	}
 
-	time_t now = time(NULL);
-	if (now > p->last) {
-		p->speed_now = p->tmp / (now - p->last);
-		if (now > p->beg) {
-			p->speed_avg = (p->cur - p->min) / (now - p->beg);
+	uint64_t now = progress_millis();
+	uint64_t diff = now - p->last;
+
+	if (diff >= PROGRESS_UPDATE_INTERVAL) {
+		double speed = 1000.0 * p->tmp / diff;
+		if (p->speed_now) {
+			/* weight depends on the time since the last update,
+			 * so that the average is independent of the call rate */
+			double alpha = 1.0 - exp(-(double)diff / PROGRESS_EWMA_TAU);
+			p->speed_now += alpha * (speed - p->speed_now);
 		} else {
-			p->speed_avg = p->speed_now;
+			p->speed_now = speed;
 		}
 
-		if (p->speed_avg) {
-			gmtime_days((p->max - p->cur) / p->speed_avg, &p->eta_days, &p->eta);
+		p->speed_avg = 1000.0 * (p->cur - p->min) / (now - p->beg);
+
+		if (p->speed_now) {
+			gmtime_days(progress_eta_millis(p) / 1000, &p->eta_days, &p->eta);
 		} else {
 			p->eta.tm_year = 0xffff;
 		}
@@ -121,11 +142,11 @@ void progress_print(struct progress *p, FILE *fp)
 	} else {
 		struct tm elapsed;
 		unsigned days;
-		time_t diff = time(NULL) - p->beg;
+		uint64_t diff = progress_millis() - p->beg;
 
-		gmtime_days(diff, &days, &elapsed);
+		gmtime_days(diff / 1000, &days, &elapsed);
 
-		long speed = (p->max - p->min) / (diff ? diff : 1);
+		long speed = 1000ULL * (p->max - p->min) / (diff ? diff : 1);
 		fprintf(fp, "      %5ld bytes/s (ELT  ", speed ? speed : p->speed_now);
 		print_time(fp, days, &elapsed);
 	}
@@ -134,6 +155,23 @@ void progress_print(struct progress *p, FILE *fp)
 	fflush(fp);
 }
 
+bool progress_print_due(struct progress *p, unsigned interval_ms)
+{
+	uint64_t now = progress_millis();
 
+	if (p->cur >= p->max || !p->last_print || (now - p->last_print) >= interval_ms) {
+		p->last_print = now;
+		return true;
+	}
+
+	return false;
+}
 
+uint64_t progress_eta_millis(const struct progress *p)
+{
+	if (!p->speed_now || p->cur >= p->max) {
+		return 0;
+	}
 
+	return 1000ULL * (p->max - p->cur) / p->speed_now;
+}
@@ -18,6 +18,8 @@
  */
 
 #include <arpa/inet.h>
+#include <algorithm>
+#include <cstddef>
 #include <cstring>
 #include "util.h"
 #include "ps.h"
@@ -46,6 +48,21 @@ void ntoh_header(ps_header::raw& raw)
 #undef NTOHL
 #undef NTOHS
 }
+
+const uint32_t max_image_size = 128 * 1024 * 1024;
+
+bool is_valid_filename(const uint8_t* p)
+{
+	for (size_t i = 0; i < sizeof(ps_header::raw::filename); ++i) {
+		if (!p[i]) {
+			return i > 1;
+		} else if (!isprint(p[i])) {
+			return false;
+		}
+	}
+
+	return true;
+}
 }
 
 ps_header& ps_header::parse(const string& buf)
@@ -68,4 +85,99 @@ string ps_header::filename() const
 	return string(m_raw.filename, strnlen(m_raw.filename, sizeof(m_raw.filename)));
 }
 
+void ps_scanner::feed(const char* buf, size_t size)
+{
+	if (!size) {
+		return;
+	}
+
+	// headers that start in the previously fed data
+	if (!m_tail.empty()) {
+		string edge = m_tail + string(buf, min(size, sizeof(ps_header::raw) - 1));
+		scan(edge.data(), edge.size(), m_pos - m_tail.size());
+	}
+
+	scan(buf, size, m_pos);
+	update(buf, size, m_pos);
+	m_pos += size;
+
+	// keep enough data to detect a header that starts in this buffer,
+	// but is not yet complete.
+	size_t keep = sizeof(ps_header::raw) - 1;
+	if (size >= keep) {
+		m_tail.assign(buf + size - keep, keep);
+	} else {
+		m_tail.append(buf, size);
+		if (m_tail.size() > keep) {
+			m_tail.erase(0, m_tail.size() - keep);
+		}
+	}
+}
+
+void ps_scanner::scan(const char* buf, size_t size, uint64_t pos)
+{
+	size_t hdrsize = sizeof(ps_header::raw);
+	size_t i = (m_alignment - (m_base + pos) % m_alignment) % m_alignment;
+
+	for (; i + hdrsize <= size; i += m_alignment) {
+		auto p = reinterpret_cast<const uint8_t*>(buf + i);
+
+		// cheap checks first: a valid compression type, and a
+		// printable first character of the filename.
+		if ((p[3] & 0x7) > ps_header::c_comp_lza || !isprint(p[offsetof(ps_header::raw, filename)])) {
+			continue;
+		}
+
+		uint16_t hcs = (p[offsetof(ps_header::raw, hcs)] << 8) | p[offsetof(ps_header::raw, hcs) + 1];
+		if ((crc16_ccitt(p, offsetof(ps_header::raw, hcs)) ^ 0xffff) != hcs) {
+			continue;
+		}
+
+		// the hcs is only 16 bits wide, so random data will match every
+		// 64k candidates or so. we thus also require a sane filename
+		// and image size.
+		if (!is_valid_filename(p + offsetof(ps_header::raw, filename))) {
+			continue;
+		}
+
+		ps_header hdr(string(buf + i, hdrsize));
+		if (hdr.length() > max_image_size) {
+			continue;
+		}
+
+		m_images.emplace_back(m_base + pos + i, hdr);
+		m_pending.push_back({ m_images.size() - 1, pos + i + hdrsize + hdr.length(), crc32_stream() });
+
+		if (m_listener) {
+			m_listener(m_images.back());
+		}
+	}
+}
+
+void ps_scanner::update(const char* buf, size_t size, uint64_t pos)
+{
+	for (auto it = m_pending.begin(); it != m_pending.end();) {
+		image& img = m_images[it->index];
+		uint64_t begin = (img.offset - m_base) + sizeof(ps_header::raw);
+		uint64_t from = max(begin, pos);
+		uint64_t to = min(it->end, pos + size);
+
+		if (from < to) {
+			it->crc.update(buf + (from - pos), to - from);
+		}
+
+		if (it->end <= pos + size) {
+			img.complete = true;
+			img.crc_valid = (it->crc.value() == img.hdr.crc());
+			it = m_pending.erase(it);
+
+			if (m_listener) {
+				m_listener(img);
+			}
+		} else {
+			++it;
+		}
+	}
+}
+
 }
@@ -19,7 +19,10 @@
 
 #ifndef BCM2DUMP_PS_H
 #define BCM2DUMP_PS_H
+#include <functional>
 #include <string>
+#include <vector>
+#include "crc.h"
 
 namespace bcm2dump {
 
@@ -72,6 +75,12 @@ class ps_header
 	uint32_t length() const
 	{ return m_raw.length; }
 
+	uint32_t loadaddr() const
+	{ return m_raw.loadaddr; }
+
+	uint32_t crc() const
+	{ return m_raw.crc; }
+
 	uint16_t compression() const
 	{ return m_raw.control & 0x7; }
 
@@ -82,5 +91,62 @@ class ps_header
 	bool m_valid = false;
 	raw m_raw;
 };
+
+// finds ProgramStore images in a stream of data, and validates their
+// payload checksum as the data is fed to the scanner.
+class ps_scanner
+{
+	public:
+	struct image
+	{
+		image(uint32_t offset, const ps_header& hdr)
+		: offset(offset), hdr(hdr) {}
+
+		uint32_t offset;
+		ps_header hdr;
+		// true if the whole payload has been seen
+		bool complete = false;
+		// only meaningful if complete is true
+		bool crc_valid = false;
+	};
+
+	// called once a header has been found, and again once
+	// the image is complete
+	typedef std::function<void(const image&)> listener;
+
+	// base is the offset of the first byte that is fed to the
+	// scanner. headers are searched at multiples of alignment.
+	ps_scanner(uint32_t base = 0, uint32_t alignment = 4)
+	: m_base(base), m_alignment(alignment) {}
+
+	void set_listener(const listener& l = listener())
+	{ m_listener = l; }
+
+	void feed(const char* buf, size_t size);
+	void feed(const std::string& buf)
+	{ feed(buf.data(), buf.size()); }
+
+	const std::vector<image>& images() const
+	{ return m_images; }
+
+	private:
+	void scan(const char* buf, size_t size, uint64_t pos);
+	void update(const char* buf, size_t size, uint64_t pos);
+
+	struct pending
+	{
+		size_t index;
+		uint64_t end;
+		crc32_stream crc;
+	};
+
+	uint32_t m_base;
+	uint32_t m_alignment;
+	listener m_listener;
+	std::vector<image> m_images;
+	std::vector<pending> m_pending;
+	std::string m_tail;
+	uint64_t m_pos = 0;
+};
 }
 #endif
@@ -18,10 +18,16 @@
  */
 
 #include <arpa/inet.h>
+#include <condition_variable>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <thread>
+#include <mutex>
+#include <deque>
 #include "bcm2dump.h"
 #include "mipsasm.h"
+#include "metrics.h"
 #include "util.h"
 #include "rwx.h"
 #include "ps.h"
@@ -34,6 +40,7 @@ namespace bcm2dump {
 namespace {
 
 const unsigned max_retry_count = 3;
+const uint32_t max_pattern_table_size = 1024;
 
 template<class T> T hex_cast(const std::string& str)
 {
@@ -50,6 +57,12 @@ template<class T> string to_buf(const T& t)
 	return string(reinterpret_cast<const char*>(&t), sizeof(T));
 }
 
+inline void append32(string& buf, uint32_t n)
+{
+	n = htonl(n);
+	buf.append(reinterpret_cast<const char*>(&n), sizeof(n));
+}
+
 template<class T> T align_to(const T& num, const T& alignment)
 {
 	if (num % alignment) {
@@ -59,11 +72,6 @@ template<class T> T align_to(const T& num, const T& alignment)
 	return num;
 }
 
-streampos tell(ostream& os)
-{
-	return os.tellp();
-}
-
 streampos tell(istream& is)
 {
 	return is.tellg();
@@ -74,11 +82,6 @@ void seek(istream& is, streamoff off, ios_base::seekdir dir)
 	is.seekg(off, dir);
 }
 
-void seek(ostream& os, streamoff off, ios_base::seekdir dir)
-{
-	os.seekp(off, dir);
-}
-
 template<class T> uint32_t get_stream_size(T& stream)
 {
 	auto ioex = scoped_ios_exceptions::none(stream);
@@ -97,6 +100,402 @@ template<class T> uint32_t get_stream_size(T& stream)
 	return length;
 }
 
+// writes data to a sink on a separate thread, so that a slow disk
+// or terminal doesn't keep us from reading the next chunk. if more
+// than <max_pending> chunks are queued, write() blocks. errors are
+// rethrown by the next call to write() or finish().
+//
+// buffers are recycled: once a buffer has been written, it is handed
+// out again by buffer(), so there are no allocations after the first
+// <max_pending> chunks.
+class async_sink
+{
+	public:
+	async_sink(sink& out, size_t max_pending = 64)
+	: m_out(out), m_queue(max_pending), m_thread(&async_sink::run, this)
+	{}
+
+	~async_sink()
+	{
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_done = true;
+		}
+
+		m_cv.notify_all();
+		m_thread.join();
+	}
+
+	// an empty buffer, possibly with some capacity left
+	string buffer()
+	{
+		lock_guard<mutex> lock(m_mutex);
+		string buf;
+
+		if (!m_free.empty()) {
+			buf = move(m_free.back());
+			m_free.pop_back();
+			buf.clear();
+		}
+
+		return buf;
+	}
+
+	// writes <length> bytes of <buf>, starting at <pos>, to <offset>
+	void write(string&& buf, size_t pos, size_t length, uint64_t offset)
+	{
+		unique_lock<mutex> lock(m_mutex);
+		m_cv.wait(lock, [this] { return m_count < m_queue.size() || m_error; });
+		rethrow_if_failed();
+
+		slice& s = m_queue[(m_first + m_count) % m_queue.size()];
+		s.buf = move(buf);
+		s.pos = pos;
+		s.length = length;
+		s.offset = offset;
+		++m_count;
+
+		lock.unlock();
+		m_cv.notify_all();
+	}
+
+	void finish()
+	{
+		unique_lock<mutex> lock(m_mutex);
+		m_cv.wait(lock, [this] { return (!m_count && !m_busy) || m_error; });
+		rethrow_if_failed();
+	}
+
+	private:
+	struct slice
+	{
+		string buf;
+		size_t pos;
+		size_t length;
+		uint64_t offset;
+	};
+
+	void rethrow_if_failed()
+	{
+		if (m_error) {
+			rethrow_exception(m_error);
+		}
+	}
+
+	void run()
+	{
+		unique_lock<mutex> lock(m_mutex);
+
+		while (true) {
+			m_cv.wait(lock, [this] { return m_count || m_done; });
+			if (!m_count || m_error) {
+				break;
+			}
+
+			slice s = move(m_queue[m_first]);
+			m_first = (m_first + 1) % m_queue.size();
+			--m_count;
+			m_busy = true;
+			lock.unlock();
+			m_cv.notify_all();
+
+			exception_ptr error;
+
+			try {
+				m_out.write(s.offset, s.buf.data() + s.pos, s.length);
+			} catch (...) {
+				error = current_exception();
+			}
+
+			lock.lock();
+			m_error = error;
+			m_busy = false;
+			if (m_free.size() <= m_queue.size()) {
+				m_free.push_back(move(s.buf));
+			}
+			m_cv.notify_all();
+		}
+	}
+
+	sink& m_out;
+	vector<slice> m_queue;
+	size_t m_first = 0;
+	size_t m_count = 0;
+	vector<string> m_free;
+	bool m_busy = false;
+	bool m_done = false;
+	exception_ptr m_error;
+	mutex m_mutex;
+	condition_variable m_cv;
+	// must be last, so that everything else is initialized
+	// by the time the thread starts
+	thread m_thread;
+};
+
+// reads a stream in blocks of <block_size> on a separate thread, so
+// that the first chunk can be written while the rest is still being
+// read. at most <max_pending> blocks are buffered, and their buffers
+// are recycled, so memory usage doesn't depend on the stream size.
+class async_source
+{
+	public:
+	async_source(istream& is, uint32_t length, uint32_t block_size, size_t max_pending = 16)
+	: m_is(is), m_length(length), m_block_size(block_size), m_queue(max_pending),
+	  m_thread(&async_source::run, this)
+	{}
+
+	~async_source()
+	{
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_done = true;
+		}
+
+		m_cv.notify_all();
+		m_thread.join();
+	}
+
+	// replaces the contents of <chunk> with the next <length> bytes
+	void read(string& chunk, uint32_t length)
+	{
+		chunk.clear();
+
+		while (chunk.size() < length) {
+			if (m_pos == m_block.size()) {
+				next_block();
+			}
+
+			size_t n = min(m_block.size() - m_pos, length - chunk.size());
+			chunk.append(m_block, m_pos, n);
+			m_pos += n;
+		}
+	}
+
+	private:
+	void next_block()
+	{
+		unique_lock<mutex> lock(m_mutex);
+
+		if (m_free.size() < m_queue.size()) {
+			m_free.push_back(move(m_block));
+		}
+
+		m_cv.wait(lock, [this] { return m_count || m_error; });
+		if (!m_count) {
+			rethrow_exception(m_error);
+		}
+
+		m_block = move(m_queue[m_first]);
+		m_first = (m_first + 1) % m_queue.size();
+		--m_count;
+		m_pos = 0;
+
+		lock.unlock();
+		m_cv.notify_all();
+	}
+
+	void run()
+	{
+		uint32_t remaining = m_length;
+		string buf;
+
+		while (remaining) {
+			{
+				unique_lock<mutex> lock(m_mutex);
+				m_cv.wait(lock, [this] { return m_count < m_queue.size() || m_done; });
+				if (m_done) {
+					break;
+				}
+
+				if (!m_free.empty()) {
+					buf = move(m_free.back());
+					m_free.pop_back();
+				}
+			}
+
+			// m_is is only ever touched by this thread
+			uint32_t n = min(remaining, m_block_size);
+			buf.resize(n);
+			m_is.read(&buf[0], n);
+
+			lock_guard<mutex> lock(m_mutex);
+
+			if (m_is.gcount() != n) {
+				m_error = make_exception_ptr(runtime_error("failed to read "
+						+ to_string(m_length) + " bytes"));
+				break;
+			}
+
+			m_queue[(m_first + m_count) % m_queue.size()] = move(buf);
+			++m_count;
+			remaining -= n;
+			m_cv.notify_all();
+		}
+
+		m_cv.notify_all();
+	}
+
+	istream& m_is;
+	uint32_t m_length;
+	uint32_t m_block_size;
+	string m_block;
+	size_t m_pos = 0;
+	vector<string> m_queue;
+	size_t m_first = 0;
+	size_t m_count = 0;
+	vector<string> m_free;
+	bool m_done = false;
+	exception_ptr m_error;
+	mutex m_mutex;
+	condition_variable m_cv;
+	thread m_thread;
+};
+
+// appends the data written to it to a string
+class string_streambuf : public streambuf
+{
+	public:
+	string_streambuf(string& buf) : m_buf(buf) {}
+
+	protected:
+	virtual streamsize xsputn(const char* s, streamsize n) override
+	{
+		m_buf.append(s, n);
+		return n;
+	}
+
+	virtual int_type overflow(int_type c) override
+	{
+		if (!traits_type::eq_int_type(c, traits_type::eof())) {
+			m_buf += traits_type::to_char_type(c);
+		}
+
+		return traits_type::not_eof(c);
+	}
+
+	private:
+	string& m_buf;
+};
+
+// discards the data written to it, and instead calculates
+// the crc32 of each <block_size> bytes
+class crc_streambuf : public streambuf
+{
+	public:
+	crc_streambuf(uint32_t block_size) : m_block_size(block_size) {}
+
+	vector<uint32_t> crcs()
+	{
+		if (m_pending) {
+			m_crcs.push_back(m_crc.value());
+			m_crc = crc32_stream();
+			m_pending = 0;
+		}
+
+		return m_crcs;
+	}
+
+	protected:
+	virtual streamsize xsputn(const char* s, streamsize n) override
+	{
+		for (streamsize i = 0; i < n;) {
+			uint32_t len = min<streamsize>(n - i, m_block_size - m_pending);
+			m_crc.update(s + i, len);
+			m_pending += len;
+			i += len;
+
+			if (m_pending == m_block_size) {
+				m_crcs.push_back(m_crc.value());
+				m_crc = crc32_stream();
+				m_pending = 0;
+			}
+		}
+
+		return n;
+	}
+
+	virtual int_type overflow(int_type c) override
+	{
+		if (!traits_type::eq_int_type(c, traits_type::eof())) {
+			char ch = traits_type::to_char_type(c);
+			xsputn(&ch, 1);
+		}
+
+		return traits_type::not_eof(c);
+	}
+
+	private:
+	uint32_t m_block_size;
+	uint32_t m_pending = 0;
+	crc32_stream m_crc;
+	vector<uint32_t> m_crcs;
+};
+
+// discards the data written to it, and instead searches it
+// for the given patterns
+class search_streambuf : public streambuf
+{
+	public:
+	search_streambuf(uint32_t offset, const vector<string>& patterns)
+	: m_offset(offset), m_patterns(patterns)
+	{
+		for (auto& p : m_patterns) {
+			m_maxlen = max(m_maxlen, p.size());
+		}
+	}
+
+	vector<rwx::match> matches()
+	{
+		find(m_window.size());
+		sort(m_matches.begin(), m_matches.end(), [] (const rwx::match& a, const rwx::match& b) {
+			return a.offset != b.offset ? a.offset < b.offset : a.pattern < b.pattern;
+		});
+		return m_matches;
+	}
+
+	protected:
+	virtual streamsize xsputn(const char* s, streamsize n) override
+	{
+		m_window.append(s, n);
+		if (m_window.size() >= m_maxlen) {
+			// a match at a later position may be incomplete
+			find(m_window.size() - m_maxlen + 1);
+		}
+		return n;
+	}
+
+	virtual int_type overflow(int_type c) override
+	{
+		if (!traits_type::eq_int_type(c, traits_type::eof())) {
+			char ch = traits_type::to_char_type(c);
+			xsputn(&ch, 1);
+		}
+
+		return traits_type::not_eof(c);
+	}
+
+	private:
+	// finds all matches starting before <end>, and discards that data
+	void find(string::size_type end)
+	{
+		for (unsigned i = 0; i < m_patterns.size(); ++i) {
+			auto pos = m_window.find(m_patterns[i]);
+			for (; pos < end; pos = m_window.find(m_patterns[i], pos + 1)) {
+				m_matches.push_back({ uint32_t(m_offset + pos), i });
+			}
+		}
+
+		m_window.erase(0, end);
+		m_offset += end;
+	}
+
+	uint32_t m_offset;
+	vector<string> m_patterns;
+	string::size_type m_maxlen = 0;
+	string m_window;
+	vector<rwx::match> m_matches;
+};
+
 uint32_t parse_num(const string& str)
 {
 	return lexical_cast<uint32_t>(str, 0);
@@ -145,13 +544,26 @@ void parse_offset_size(rwx& rwx, const string& arg, uint32_t& offset, uint32_t&
 	}
 }
 
+// discards pending output (i.e. the remainder of an aborted dump) until
+// the interface has been quiet for 100ms, or up to 1 second has passed.
+void drain_interface(const interface::sp& intf)
+{
+	auto start = chrono::steady_clock::now();
+
+	while (intf->pending(100)) {
+		intf->readln(100);
+		if (chrono::steady_clock::now() - start >= chrono::seconds(1)) {
+			break;
+		}
+	}
+}
+
 bool wait_for_interface(const interface::sp& intf)
 {
 	for (unsigned i = 0; i < 10; ++i) {
+		drain_interface(intf);
 		if (intf->is_ready(false)) {
 			return true;
-		} else if (i != 9) {
-			sleep(1);
 		}
 	}
 
@@ -171,9 +583,9 @@ class parsing_rwx : public rwx
 	{ return cap_read; }
 
 	protected:
-	virtual string read_chunk(uint32_t offset, uint32_t length) override final
+	virtual void read_chunk(uint32_t offset, uint32_t length, string& chunk) override final
 	{
-		return read_chunk_impl(offset, length, 0);
+		read_chunk_impl(offset, length, chunk, 0);
 	}
 
 	virtual string read_special(uint32_t offset, uint32_t length) override;
@@ -181,13 +593,13 @@ class parsing_rwx : public rwx
 	virtual unsigned chunk_timeout(uint32_t offset, uint32_t length) const
 	{ return 0; }
 
-	virtual string read_chunk_impl(uint32_t offset, uint32_t length, uint32_t retries);
+	virtual void read_chunk_impl(uint32_t offset, uint32_t length, string& chunk, uint32_t retries);
 	// issues a command that displays the requested chunk
 	virtual void do_read_chunk(uint32_t offset, uint32_t length) = 0;
 	// checks if the line is junk (as opposed to a possible chunk line)
 	virtual bool is_ignorable_line(const string& line) = 0;
-	// parses one line of data
-	virtual string parse_chunk_line(const string& line, uint32_t offset) = 0;
+	// parses one line of data, and appends it to <chunk>
+	virtual void parse_chunk_line(const string& line, uint32_t offset, string& chunk) = 0;
 	// called if a chunk was not successfully read
 	virtual void on_chunk_retry(uint32_t offset, uint32_t length) {}
 };
@@ -196,7 +608,8 @@ string parsing_rwx::read_special(uint32_t offset, uint32_t length)
 {
 	require_capability(cap_special);
 
-	string buf = read_chunk(0, 0);
+	string buf;
+	read_chunk(0, 0, buf);
 	if (offset >= buf.size()) {
 		return "";
 	} else if (!length) {
@@ -206,14 +619,19 @@ string parsing_rwx::read_special(uint32_t offset, uint32_t length)
 	}
 }
 
-string parsing_rwx::read_chunk_impl(uint32_t offset, uint32_t length, uint32_t retries)
+void parsing_rwx::read_chunk_impl(uint32_t offset, uint32_t length, string& chunk, uint32_t retries)
 {
 	do_read_chunk(offset, length);
 
-	string line, linebuf, chunk, last;
+	string line, last;
 	uint32_t pos = offset;
-	clock_t start = clock();
+	chunk.clear();
+	auto start = chrono::steady_clock::now();
 	unsigned timeout = chunk_timeout(offset, length);
+	bool first = true;
+
+	static metrics::counter lines_ignored("rwx.lines_ignored");
+	static metrics::counter lines_parsed("rwx.lines_parsed");
 
 	do {
 		while ((!length || chunk.size() < length) && m_intf->pending()) {
@@ -222,18 +640,31 @@ string parsing_rwx::read_chunk_impl(uint32_t offset, uint32_t length, uint32_t r
 			line = trim(m_intf->readln());
 
 			if (is_ignorable_line(line)) {
+				lines_ignored.add();
 				continue;
 			} else {
 				// no need for the timeout anymore, because we have the chunk line
 				timeout = 0;
 
+				if (first) {
+					// command round trip, including the device's response time
+					metrics::time("rwx.first_line", start);
+					first = false;
+				}
+
+				lines_parsed.add();
+
+				auto size = chunk.size();
+
 				try {
-					string linebuf = parse_chunk_line(line, pos);
-					pos += linebuf.size();
-					chunk += linebuf;
+					parse_chunk_line(line, pos, chunk);
+					pos += chunk.size() - size;
 					last = line;
 					update_progress(pos, chunk.size());
 				} catch (const exception& e) {
+					chunk.resize(size);
+					metrics::count("rwx.parse_errors");
+
 					string msg = "failed to parse chunk line @" + to_hex(pos) + ": '" + line + "' (" + e.what() + ")";
 					if (retries >= max_retry_count) {
 						throw runtime_error(msg);
@@ -246,6 +677,12 @@ string parsing_rwx::read_chunk_impl(uint32_t offset, uint32_t length, uint32_t r
 		}
 	} while (timeout && elapsed_millis(start) < timeout);
 
+	if (timeout) {
+		metrics::count("rwx.timeouts");
+	}
+
+	metrics::time("rwx.read_attempt", start);
+
 	if (length && (chunk.size() != length)) {
 		string msg = "read incomplete chunk 0x" + to_hex(offset)
 					+ ": " + to_string(chunk.size()) + "/" +to_string(length);
@@ -253,18 +690,23 @@ string parsing_rwx::read_chunk_impl(uint32_t offset, uint32_t length, uint32_t r
 			// if the dump is still underway, we need to wait for it to finish
 			// before issuing the next command. wait for up to 10 seconds.
 
-			if (wait_for_interface(m_intf)) {
+			++m_stats.retries;
+			metrics::count("rwx.retries");
+
+			auto wait_start = chrono::steady_clock::now();
+			bool ready = wait_for_interface(m_intf);
+			metrics::time("rwx.retry_wait", wait_start);
+
+			if (ready) {
 				logger::d() << endl << msg << "; retrying" << endl;
 				on_chunk_retry(offset, length);
-				return read_chunk_impl(offset, length, retries + 1);
+				return read_chunk_impl(offset, length, chunk, retries + 1);
 			}
 		}
 
 		throw runtime_error(msg);
 
 	}
-
-	return chunk;
 }
 
 class bfc_ram : public parsing_rwx
@@ -286,7 +728,7 @@ class bfc_ram : public parsing_rwx
 	virtual bool write_chunk(uint32_t offset, const string& chunk) override;
 	virtual void do_read_chunk(uint32_t offset, uint32_t length) override;
 	virtual bool is_ignorable_line(const string& line) override;
-	virtual string parse_chunk_line(const string& line, uint32_t offset) override;
+	virtual void parse_chunk_line(const string& line, uint32_t offset, string& chunk) override;
 
 	virtual void init(uint32_t offset, uint32_t length, bool write) override;
 
@@ -347,16 +789,14 @@ bool bfc_ram::is_ignorable_line(const string& line)
 	return true;
 }
 
-string bfc_ram::parse_chunk_line(const string& line, uint32_t offset)
+void bfc_ram::parse_chunk_line(const string& line, uint32_t offset, string& chunk)
 {
-	string linebuf;
-
 	if (!m_hint_decimal) {
 		if (offset != hex_cast<uint32_t>(line.substr(0, 8))) {
 			throw runtime_error("offset mismatch");
 		}
 		for (unsigned i = 0; i < 4; ++i) {
-			linebuf += to_buf(htonl(hex_cast<uint32_t>(line.substr((i + 1) * 10, 8))));
+			append32(chunk, hex_cast<uint32_t>(line.substr((i + 1) * 10, 8)));
 		}
 	} else {
 		auto beg = line.find(": ");
@@ -367,12 +807,10 @@ string bfc_ram::parse_chunk_line(const string& line, uint32_t offset)
 		for (unsigned i = 0; i < 4; ++i) {
 			beg = line.find_first_of("0123456789", beg);
 			auto end = line.find_first_not_of("0123456789", beg);
-			linebuf += to_buf(htonl(lexical_cast<uint32_t>(line.substr(beg, end - beg))));
+			append32(chunk, lexical_cast<uint32_t>(line.substr(beg, end - beg)));
 			beg = end;
 		}
 	}
-
-	return linebuf;
 }
 
 void bfc_ram::init(uint32_t offset, uint32_t length, bool write)
@@ -416,7 +854,7 @@ class bfc_flash : public parsing_rwx
 
 	virtual void do_read_chunk(uint32_t offset, uint32_t length) override;
 	virtual bool is_ignorable_line(const string& line) override;
-	virtual string parse_chunk_line(const string& line, uint32_t offset) override;
+	virtual void parse_chunk_line(const string& line, uint32_t offset, string& chunk) override;
 
 	private:
 	uint32_t to_partition_offset(uint32_t offset);
@@ -500,10 +938,8 @@ bool bfc_flash::is_ignorable_line(const string& line)
 	return true;
 }
 
-string bfc_flash::parse_chunk_line(const string& line, uint32_t offset)
+void bfc_flash::parse_chunk_line(const string& line, uint32_t offset, string& chunk)
 {
-	string linebuf;
-
 #ifdef BFC_FLASH_READ_DIRECT
 	for (unsigned i = 0; i < 16; ++i) {
 		// don't change this to uint8_t
@@ -512,19 +948,17 @@ string bfc_flash::parse_chunk_line(const string& line, uint32_t offset)
 			throw runtime_error("value out of range: 0x" + to_hex(val));
 		}
 
-		linebuf += char(val);
+		chunk += char(val);
 	}
 #else
 	for (size_t i = 0; i < line.size(); i += 9) {
-		linebuf += to_buf(htonl(hex_cast<uint32_t>(line.substr(i, 8))));
+		append32(chunk, hex_cast<uint32_t>(line.substr(i, 8)));
 
 		if (!(i % 128)) {
 			update_progress(offset + i, 0);
 		}
 	}
 #endif
-
-	return linebuf;
 }
 
 uint32_t bfc_flash::to_partition_offset(uint32_t offset)
@@ -560,7 +994,7 @@ class bootloader_ram : public parsing_rwx
 
 	virtual void do_read_chunk(uint32_t offset, uint32_t length) override;
 	virtual bool is_ignorable_line(const string& line) override;
-	virtual string parse_chunk_line(const string& line, uint32_t offset) override;
+	virtual void parse_chunk_line(const string& line, uint32_t offset, string& chunk) override;
 };
 
 void bootloader_ram::init(uint32_t offset, uint32_t length, bool write)
@@ -609,17 +1043,17 @@ bool bootloader_ram::is_ignorable_line(const string& line)
 	return true;
 }
 
-string bootloader_ram::parse_chunk_line(const string& line, uint32_t offset)
+void bootloader_ram::parse_chunk_line(const string& line, uint32_t offset, string& chunk)
 {
 	if (line.find("Value at") == 0) {
 		if (offset != hex_cast<uint32_t>(line.substr(9, 8))) {
 			throw runtime_error("offset mismatch");
 		}
 
-		return to_buf(htonl(hex_cast<uint32_t>(line.substr(19, 8))));
+		append32(chunk, hex_cast<uint32_t>(line.substr(19, 8)));
+	} else {
+		throw runtime_error("unexpected line");
 	}
-
-	throw runtime_error("unexpected line");
 }
 
 bool bootloader_ram::exec_impl(uint32_t offset)
@@ -631,7 +1065,7 @@ bool bootloader_ram::exec_impl(uint32_t offset)
 	return true;
 }
 
-// this defines uint32 dumpcode[]
+// this defines uint32 dumpcode[], crccode[] and findcode[]
 #include "dumpcode.h"
 
 class dumpcode_rwx : public parsing_rwx
@@ -646,6 +1080,9 @@ class dumpcode_rwx : public parsing_rwx
 	virtual limits limits_write() const override
 	{ return limits(); }
 
+	unsigned capabilities() const override
+	{ return cap_read | cap_checksum; }
+
 	virtual void set_interface(const interface::sp& intf) override
 	{
 		parsing_rwx::set_interface(intf);
@@ -681,18 +1118,14 @@ class dumpcode_rwx : public parsing_rwx
 		return true;
 	}
 
-	virtual string parse_chunk_line(const string& line, uint32_t offset) override
+	virtual void parse_chunk_line(const string& line, uint32_t offset, string& chunk) override
 	{
-		string linebuf;
-
 		auto values = split(line.substr(1), ':');
 		if (values.size() == 4) {
 			for (string val : values) {
-				linebuf += to_buf(htonl(hex_cast<uint32_t>(val)));
+				append32(chunk, hex_cast<uint32_t>(val));
 			}
 		}
-
-		return linebuf;
 	}
 
 	protected:
@@ -726,8 +1159,8 @@ class dumpcode_rwx : public parsing_rwx
 
 	void init(uint32_t offset, uint32_t length, bool write) override
 	{
-		const profile::sp& profile = m_intf->profile();
-		const codecfg& cfg = profile->codecfg(m_intf->id());
+		metrics::timer t("dumpcode.init");
+		const codecfg& cfg = m_intf->profile()->codecfg(m_intf->id());
 
 		if (cfg.buflen && length > cfg.buflen) {
 			throw runtime_error("requested length exceeds buffer size ("
@@ -738,78 +1171,282 @@ class dumpcode_rwx : public parsing_rwx
 		m_dump_length = length;
 		//m_rwx_func = m_space.get_read_func(m_intf->id());
 
-		uint32_t kseg1 = profile->kseg1();
-		m_loadaddr = kseg1 | cfg.loadaddr;
-
 		// FIXME check whether we have a custom dumpcode file
 		if (true) {
-			m_code = string(reinterpret_cast<const char*>(dumpcode), sizeof(dumpcode));
-			m_entry = 0x4c;
-
-			patch32(m_code, 0x10, 0);
-			patch32(m_code, 0x14, kseg1 | cfg.buffer);
-			patch32(m_code, 0x18, offset);
-			patch32(m_code, 0x1c, length);
-			patch32(m_code, 0x20, limits_read().max);
-			patch32(m_code, 0x24, kseg1 | cfg.printf);
-
-			if (m_read_func.addr()) {
-				patch32(m_code, 0x0c, m_read_func.args());
-				patch32(m_code, 0x28, kseg1 | m_read_func.addr());
-
-				unsigned i = 0;
-				for (auto patch : m_read_func.patches()) {
-					uint32_t offset = 0x2c + (8 * i++);
-					uint32_t addr = patch->addr;
-					patch32(m_code, offset, addr ? (kseg1 | addr) : 0);
-					patch32(m_code, offset + 4, addr ? patch->word : 0);
+			load_code(dumpcode, sizeof(dumpcode), offset, length, limits_read().max);
+		}
+	}
+
+	virtual vector<uint32_t> checksum_impl(uint32_t offset, uint32_t length, uint32_t block_size) override
+	{
+		const codecfg& cfg = m_intf->profile()->codecfg(m_intf->id());
+
+		// when reading from flash, the data must fit into the buffer
+		uint32_t max = length;
+		if (m_read_func.addr() && cfg.buflen) {
+			max = align_left(cfg.buflen, block_size);
+			if (!max) {
+				throw user_error("block size exceeds buffer size ("
+						+ to_string(cfg.buflen) + " b)");
+			}
+		}
+
+		init_progress(offset, length, false);
+
+		auto start = chrono::steady_clock::now();
+		m_stats = stats();
+
+		vector<uint32_t> crcs;
+		uint32_t pos = 0;
+
+		while (pos < length) {
+			throw_if_interrupted();
+
+			uint32_t n = min(length - pos, max);
+			load_code(crccode, sizeof(crccode), offset + pos, n, block_size);
+			m_ram->exec(m_loadaddr + m_entry);
+
+			// allow for a slow flash read before the first line; after
+			// that, each block should take a few seconds at most.
+			unsigned timeout = m_read_func.addr() ? 60 * 1000 : 10 * 1000;
+			uint32_t count = crcs.size() + (n + block_size - 1) / block_size;
+			auto last = chrono::steady_clock::now();
+
+			while (crcs.size() < count) {
+				throw_if_interrupted();
+
+				if (!m_intf->pending()) {
+					if (elapsed_millis(last) >= timeout) {
+						throw runtime_error("timeout while waiting for checksum of block at 0x"
+								+ to_hex(offset + crcs.size() * block_size));
+					}
+					continue;
+				}
+
+				string line = trim(m_intf->readln());
+				if (line.size() < 2 || line.size() > 9 || line[0] != ':') {
+					continue;
+				}
+
+				crcs.push_back(hex_cast<uint32_t>(line.substr(1)));
+				last = chrono::steady_clock::now();
+
+				uint32_t done = min(uint64_t(crcs.size()) * block_size, uint64_t(length));
+				update_progress(offset + done, block_size);
+				++m_stats.chunks;
+			}
+
+			pos += n;
+			m_stats.bytes += n;
+			m_stats.millis = elapsed_millis(start);
+		}
+
+		return crcs;
+	}
+
+	virtual vector<match> search_impl(uint32_t offset, uint32_t length, const vector<string>& patterns) override
+	{
+		const codecfg& cfg = m_intf->profile()->codecfg(m_intf->id());
+
+		string table;
+		uint32_t maxlen = 0;
+
+		for (unsigned i = 0; i < patterns.size(); ++i) {
+			const string& p = patterns[i];
+			table += to_buf(htonl(p.size())) + to_buf(htonl(i)) + p;
+			table.resize(align_right(table.size(), 4));
+			maxlen = max(maxlen, uint32_t(p.size()));
+		}
+
+		table += to_buf(uint32_t(0));
+
+		if (table.size() > max_pattern_table_size) {
+			throw user_error("search patterns exceed " + to_string(max_pattern_table_size) + " b");
+		}
+
+		// when reading from flash, the data must fit into the buffer. to
+		// catch matches spanning two passes, the buffers overlap.
+		uint32_t max = length;
+		if (m_read_func.addr() && cfg.buflen) {
+			if (cfg.buflen < 2 * maxlen) {
+				throw user_error("search patterns too long for buffer size ("
+						+ to_string(cfg.buflen) + " b)");
+			}
+			max = cfg.buflen - (maxlen - 1);
+		}
+
+		init_progress(offset, length, false);
+
+		auto start = chrono::steady_clock::now();
+		m_stats = stats();
+
+		vector<match> matches;
+		uint32_t pos = 0;
+
+		while (pos < length) {
+			throw_if_interrupted();
+
+			uint32_t n = min(length - pos, max);
+			uint32_t readlen = min(length - pos, n + maxlen - 1);
+			load_code(findcode, sizeof(findcode), offset + pos, readlen, n, table);
+			m_ram->exec(m_loadaddr + m_entry);
+
+			unsigned timeout = 60 * 1000;
+			auto last = chrono::steady_clock::now();
+			bool done = false;
+
+			while (!done) {
+				throw_if_interrupted();
+
+				if (!m_intf->pending()) {
+					if (elapsed_millis(last) >= timeout) {
+						throw runtime_error("timeout while searching at 0x" + to_hex(offset + pos));
+					}
+					continue;
+				}
+
+				string line = trim(m_intf->readln());
+				if (line.size() < 2 || line.size() > 18 || line[0] != ':') {
+					continue;
+				}
+
+				auto values = split(line.substr(1), ':');
+				if (values.size() == 2) {
+					unsigned pattern = hex_cast<unsigned>(values[1]);
+					if (pattern >= patterns.size()) {
+						throw runtime_error("invalid pattern index in line '" + line + "'");
+					}
+
+					matches.push_back({ hex_cast<uint32_t>(values[0]), pattern });
+				} else if (values.size() == 1) {
+					if (hex_cast<uint32_t>(values[0]) != offset + pos + n) {
+						throw runtime_error("unexpected end of search: '" + line + "'");
+					}
+					done = true;
 				}
+
+				last = chrono::steady_clock::now();
 			}
 
-			uint32_t codesize = m_code.size();
-			if (mipsasm_resolve_labels(reinterpret_cast<uint32_t*>(&m_code[0]), &codesize, m_entry) != 0) {
-				throw runtime_error("failed to resolve mips asm labels");
+			pos += n;
+			update_progress(offset + pos, n);
+
+			m_stats.bytes += readlen;
+			++m_stats.chunks;
+			m_stats.millis = elapsed_millis(start);
+		}
+
+		return matches;
+	}
+
+	// patches the parameter block of the given code, and uploads it
+	// to the device (along with <data>, if any), unless it's already
+	// there.
+	void load_code(const uint32_t* code, size_t size, uint32_t offset, uint32_t length, uint32_t chunklen,
+			const string& data = "")
+	{
+		const profile::sp& profile = m_intf->profile();
+		const codecfg& cfg = profile->codecfg(m_intf->id());
+
+		uint32_t kseg1 = profile->kseg1();
+		m_loadaddr = kseg1 | cfg.loadaddr;
+
+		m_code = string(reinterpret_cast<const char*>(code), size);
+		m_entry = 0x4c;
+
+		patch32(m_code, 0x10, 0);
+		patch32(m_code, 0x14, kseg1 | cfg.buffer);
+		patch32(m_code, 0x18, offset);
+		patch32(m_code, 0x1c, length);
+		patch32(m_code, 0x20, chunklen);
+		patch32(m_code, 0x24, kseg1 | cfg.printf);
+
+		if (m_read_func.addr()) {
+			patch32(m_code, 0x0c, m_read_func.args());
+			patch32(m_code, 0x28, kseg1 | m_read_func.addr());
+
+			unsigned i = 0;
+			for (auto patch : m_read_func.patches()) {
+				uint32_t offset = 0x2c + (8 * i++);
+				uint32_t addr = patch->addr;
+				patch32(m_code, offset, addr ? (kseg1 | addr) : 0);
+				patch32(m_code, offset + 4, addr ? patch->word : 0);
 			}
+		}
+
+		uint32_t codesize = m_code.size();
+		if (mipsasm_resolve_labels(reinterpret_cast<uint32_t*>(&m_code[0]), &codesize, m_entry) != 0) {
+			throw runtime_error("failed to resolve mips asm labels");
+		}
 
-			m_code.resize(codesize);
-			uint32_t expected = 0xc0de0000 | crc16_ccitt(m_code.substr(m_entry, m_code.size() - 4 - m_entry));
-			uint32_t actual = ntohl(extract<uint32_t>(m_ram->read(m_loadaddr + m_code.size() - 4, 4)));
-			bool quick = (expected == actual);
+		m_code.resize(codesize);
+		uint32_t expected = 0xc0de0000 | crc16_ccitt(m_code.substr(m_entry, m_code.size() - 4 - m_entry));
+		uint32_t actual = ntohl(extract<uint32_t>(m_ram->read(m_loadaddr + m_code.size() - 4, 4)));
+		bool quick = (expected == actual);
 
-			patch32(m_code, codesize - 4, expected);
+		patch32(m_code, codesize - 4, expected);
 
-			progress pg;
-			progress_init(&pg, m_loadaddr, m_code.size());
+		if (!data.empty()) {
+			patch32(m_code, 0x10, m_loadaddr + codesize);
+			m_code += data;
+		}
 
-			if (m_prog_l && !quick) {
-				printf("updating dump code at 0x%08x (%u b)\n", m_loadaddr, codesize);
+		if (quick && m_loaded.size() == m_code.size()
+				&& !m_loaded.compare(m_entry, codesize - m_entry, m_code, m_entry, codesize - m_entry)) {
+			// the code we've uploaded earlier is still there, so we only
+			// need to update the parameters (and data). there's no need
+			// to read back the code either.
+			for (uint32_t i = 0; i < m_code.size(); i += 4) {
+				bool scratch = (i == 0x10 || i == 0x14 || i == 0x1c);
+				if (scratch || m_loaded.compare(i, 4, m_code, i, 4)) {
+					m_ram->write(m_loadaddr + i, m_code.substr(i, 4));
+				}
 			}
 
-			for (unsigned pass = 0; pass < 2; ++pass) {
-				string ramcode = m_ram->read(m_loadaddr, m_code.size());
-				for (uint32_t i = 0; i < m_code.size(); i += 4) {
-					if (!quick && pass == 0 && m_prog_l) {
-						progress_add(&pg, 4);
+			m_loaded = m_code;
+			metrics::count("dumpcode.reused");
+			return;
+		}
+
+		metrics::timer t("dumpcode.upload");
+		progress pg;
+		progress_init(&pg, m_loadaddr, m_code.size());
+
+		if (m_prog_l && !quick) {
+			printf("updating dump code at 0x%08x (%u b)\n", m_loadaddr, codesize);
+		}
+
+		for (unsigned pass = 0; pass < 2; ++pass) {
+			string ramcode = m_ram->read(m_loadaddr, m_code.size());
+			for (uint32_t i = 0; i < m_code.size(); i += 4) {
+				if (!quick && pass == 0 && m_prog_l) {
+					progress_add(&pg, 4);
+					if (progress_print_due(&pg, 100)) {
 						printf("\r ");
 						progress_print(&pg, stdout);
 					}
+				}
 
-					if (ramcode.substr(i, 4) != m_code.substr(i, 4)) {
-						if (pass == 1) {
-							throw runtime_error("dump code verification failed at 0x" + to_hex(i + m_loadaddr, 8));
-						}
-						m_ram->write(m_loadaddr + i, m_code.substr(i, 4));
+				if (ramcode.substr(i, 4) != m_code.substr(i, 4)) {
+					if (pass == 1) {
+						throw runtime_error("dump code verification failed at 0x" + to_hex(i + m_loadaddr, 8));
 					}
+					m_ram->write(m_loadaddr + i, m_code.substr(i, 4));
 				}
+			}
 
-				if (!quick && pass == 0 && m_prog_l) {
-					printf("\n");
-				}
+			if (!quick && pass == 0 && m_prog_l) {
+				printf("\n");
 			}
 		}
+
+		m_loaded = m_code;
 	}
 
 	string m_code;
+	// the code as last uploaded, minus the words modified by the code
+	// itself (dump offset, buffer and length)
+	string m_loaded;
 	uint32_t m_loadaddr = 0;
 	uint32_t m_entry = 0;
 
@@ -860,7 +1497,7 @@ class bfc_cmcfg : public parsing_rwx
 	protected:
 	virtual void do_read_chunk(uint32_t offset, uint32_t length) override;
 	virtual bool is_ignorable_line(const string& line) override;
-	virtual string parse_chunk_line(const string& line, uint32_t offset) override;
+	virtual void parse_chunk_line(const string& line, uint32_t offset, string& chunk) override;
 
 	virtual string read_special(uint32_t offset, uint32_t length) override
 	{ return parsing_rwx::read_special(offset, length) + "\xff"; }
@@ -878,9 +1515,8 @@ bool bfc_cmcfg::is_ignorable_line(const string& line)
 	return ret;
 }
 
-string bfc_cmcfg::parse_chunk_line(const string& line, uint32_t offset)
+void bfc_cmcfg::parse_chunk_line(const string& line, uint32_t offset, string& chunk)
 {
-	string linebuf;
 	for (unsigned i = 0; i < 16; ++i) {
 		unsigned offset = 2 * (i / 4) + 3 * i;
 		if (offset > line.size() || offset + 2 > line.size()) {
@@ -888,15 +1524,13 @@ string bfc_cmcfg::parse_chunk_line(const string& line, uint32_t offset)
 		}
 
 		try {
-			linebuf += hex_cast<int>(line.substr(offset, 2));
+			chunk += hex_cast<int>(line.substr(offset, 2));
 		} catch (const bad_lexical_cast& e) {
 			if (line.size() == 73) {
 				throw e;
 			}
 		}
 	}
-
-	return linebuf;
 }
 }
 
@@ -951,10 +1585,16 @@ void rwx::exec(uint32_t offset)
 }
 
 void rwx::dump(uint32_t offset, uint32_t length, std::ostream& os, bool resume)
+{
+	auto out = sink::create(os);
+	dump(offset, length, *out, resume);
+}
+
+void rwx::dump(uint32_t offset, uint32_t length, sink& out, bool resume)
 {
 	require_capability(cap_read);
 
-	auto ioex = scoped_ios_exceptions::failbad(os);
+	metrics::timer t("rwx.dump");
 	auto cleaner = make_cleaner();
 
 	if (capabilities() & cap_special) {
@@ -964,14 +1604,20 @@ void rwx::dump(uint32_t offset, uint32_t length, std::ostream& os, bool resume)
 
 		do_init(0, 0, false);
 		update_progress(0, 0, true);
-		read_special(offset, length, os);
+		string buf = read_special(offset, length);
+		out.reserve(buf.size());
+		out.write(0, buf.data(), buf.size());
+		out.finish();
 		return;
 	} else {
 		m_space.check_range(offset, length);
 	}
 
+	// position in the output
+	uint64_t pos = 0;
+
 	if (resume) {
-		uint32_t completed = get_stream_size(os);
+		uint32_t completed = out.size();
 		if (completed >= length) {
 			logger::i() << "nothing to resume" << endl;
 			return;
@@ -982,6 +1628,7 @@ void rwx::dump(uint32_t offset, uint32_t length, std::ostream& os, bool resume)
 				completed -= overlap;
 				offset += completed;
 				length -= completed;
+				pos = completed;
 				logger::v() << "resuming at offset 0x" + to_hex(offset) << endl;
 			}
 		}
@@ -999,14 +1646,28 @@ void rwx::dump(uint32_t offset, uint32_t length, std::ostream& os, bool resume)
 	do_init(offset_r, length_r, false);
 	init_progress(offset_r, length_r, false);
 
-	string hdrbuf;
-	bool show_hdr = true;
+	auto start = chrono::steady_clock::now();
+	m_stats = stats();
+
+	ps_scanner scanner(offset);
+	scanner.set_listener([this] (const ps_scanner::image& img) {
+		image_event(img);
+	});
+
+	out.reserve(pos + length);
+	async_sink sink(out);
 
 	while (length_r) {
 		throw_if_interrupted();
 
 		uint32_t n = min(length_r, limits_read().max);
-		string chunk = read_chunk(offset_r, n);
+		string chunk = sink.buffer();
+		auto chunk_start = chrono::steady_clock::now();
+		unsigned retries = m_stats.retries;
+		read_chunk(offset_r, n, chunk);
+		chunk_event(offset_r, n, elapsed_millis(chunk_start), m_stats.retries - retries);
+		metrics::time("rwx.read_chunk", chunk_start);
+		metrics::count("rwx.payload_bytes_read", chunk.size());
 
 		if (offset_r > (offset + length)) {
 			update_progress(offset + length - 2, 0);
@@ -1022,37 +1683,32 @@ void rwx::dump(uint32_t offset, uint32_t length, std::ostream& os, bool resume)
 
 		throw_if_interrupted();
 
-		string chunk_w;
+		// the part of the chunk that was actually requested
+		uint32_t pos_w = 0, n_w = 0;
 
 		if (offset_r < offset && (offset_r + n) >= offset) {
-			uint32_t pos = offset - offset_r;
-			chunk_w = chunk.substr(pos, min(n - pos, length_w));
+			pos_w = offset - offset_r;
+			n_w = min(n - pos_w, length_w);
 		} else if (offset_r >= offset && length_w) {
-			chunk_w = chunk.substr(0, min(n, length_w));
-		}
-
-		os.write(chunk_w.data(), chunk_w.size());
-
-		if (show_hdr) {
-			if (hdrbuf.size() < sizeof(ps_header)) {
-				hdrbuf += chunk_w;
-			}
-
-			if (hdrbuf.size() >= sizeof(ps_header)) {
-				ps_header hdr(hdrbuf);
-
-				if (hdr.hcs_valid()) {
-					image_detected(offset, hdr);
-				}
-
-				show_hdr = false;
-			}
+			n_w = min(n, length_w);
 		}
 
-		length_w -= chunk_w.size();
+		length_w -= n_w;
 		length_r -= n;
 		offset_r += n;
+
+		scanner.feed(chunk.data() + pos_w, n_w);
+		sink.write(move(chunk), pos_w, n_w, pos);
+		pos += n_w;
+
+		m_stats.bytes += n;
+		++m_stats.chunks;
+		m_stats.millis = elapsed_millis(start);
 	}
+
+	sink.finish();
+	out.finish();
+	m_stats.millis = elapsed_millis(start);
 }
 
 void rwx::dump(const string& spec, ostream& os, bool resume)
@@ -1063,11 +1719,89 @@ void rwx::dump(const string& spec, ostream& os, bool resume)
 	return dump(offset, length, os, resume);
 }
 
+void rwx::dump(const string& spec, sink& out, bool resume)
+{
+	require_capability(cap_read);
+	uint32_t offset, length;
+	parse_offset_size(*this, spec, offset, length, false);
+	return dump(offset, length, out, resume);
+}
+
 string rwx::read(uint32_t offset, uint32_t length)
 {
-	ostringstream ostr;
-	dump(offset, length, ostr);
-	return ostr.str();
+	string buf;
+	buf.reserve(length);
+	string_streambuf sb(buf);
+	ostream os(&sb);
+	dump(offset, length, os);
+	return buf;
+}
+
+void rwx::parse_spec(const string& spec, uint32_t& offset, uint32_t& length, bool write)
+{
+	parse_offset_size(*this, spec, offset, length, write);
+}
+
+vector<uint32_t> rwx::checksum(const string& spec, uint32_t block_size)
+{
+	require_capability(cap_read);
+	uint32_t offset, length;
+	parse_offset_size(*this, spec, offset, length, false);
+	return checksum(offset, length, block_size);
+}
+
+vector<uint32_t> rwx::checksum(uint32_t offset, uint32_t length, uint32_t block_size)
+{
+	require_capability(cap_read);
+
+	if (!block_size) {
+		throw invalid_argument("block size must not be zero");
+	}
+
+	m_space.check_range(offset, length);
+	return checksum_impl(offset, length, block_size);
+}
+
+vector<uint32_t> rwx::checksum_impl(uint32_t offset, uint32_t length, uint32_t block_size)
+{
+	crc_streambuf buf(block_size);
+	ostream os(&buf);
+	dump(offset, length, os);
+	return buf.crcs();
+}
+
+vector<rwx::match> rwx::search(const string& spec, const vector<string>& patterns)
+{
+	require_capability(cap_read);
+	uint32_t offset, length;
+	parse_offset_size(*this, spec, offset, length, false);
+	return search(offset, length, patterns);
+}
+
+vector<rwx::match> rwx::search(uint32_t offset, uint32_t length, const vector<string>& patterns)
+{
+	require_capability(cap_read);
+
+	if (patterns.empty()) {
+		throw invalid_argument("no search patterns specified");
+	}
+
+	for (auto& p : patterns) {
+		if (p.empty()) {
+			throw invalid_argument("search pattern must not be empty");
+		}
+	}
+
+	m_space.check_range(offset, length);
+	return search_impl(offset, length, patterns);
+}
+
+vector<rwx::match> rwx::search_impl(uint32_t offset, uint32_t length, const vector<string>& patterns)
+{
+	search_streambuf buf(offset, patterns);
+	ostream os(&buf);
+	dump(offset, length, os);
+	return buf.matches();
 }
 
 void rwx::write(const string& spec, istream& is)
@@ -1078,33 +1812,59 @@ void rwx::write(const string& spec, istream& is)
 	write(offset, is, length);
 }
 
-void rwx::write(uint32_t offset, istream& is, uint32_t length)
+void rwx::write(const string& spec, const char* buf, uint32_t size)
 {
 	require_capability(cap_write);
+	uint32_t offset, length;
+	parse_offset_size(*this, spec, offset, length, true);
 
 	if (!length) {
-		length = get_stream_size(is);
+		length = size;
+	} else if (length > size) {
+		throw user_error("failed to read " + to_string(length) + " bytes");
 	}
 
-	auto ioex = scoped_ios_exceptions::failbad(is);
+	write(offset, buf, length);
+}
 
-	string buf;
-	buf.resize(length);
-	if (is.readsome(&buf[0], length) != length) {
-		throw runtime_error("failed to read " + to_string(length) + " bytes");
+void rwx::write(uint32_t offset, istream& is, uint32_t length)
+{
+	require_capability(cap_write);
+
+	if (!length) {
+		length = get_stream_size(is);
 	}
 
-	write(offset, buf);
+	// some interfaces write only a few bytes per chunk, so the input
+	// is read in larger blocks
+	async_source source(is, length, max(limits_write().max, 16384u));
+	write_chunks(offset, length, [&source] (string& chunk, uint32_t n) {
+		source.read(chunk, n);
+	});
 }
 
 void rwx::write(uint32_t offset, const string& buf, uint32_t length)
 {
-	require_capability(cap_write);
-
 	if (!length) {
 		length = buf.size();
 	}
-	
+
+	write(offset, buf.data(), min<size_t>(length, buf.size()));
+}
+
+void rwx::write(uint32_t offset, const char* buf, uint32_t length)
+{
+	require_capability(cap_write);
+
+	const char* p = buf;
+	write_chunks(offset, length, [&p] (string& chunk, uint32_t n) {
+		chunk.assign(p, n);
+		p += n;
+	});
+}
+
+void rwx::write_chunks(uint32_t offset, uint32_t length, const chunk_source& next)
+{
 	m_space.check_range(offset, length);
 
 	limits lim = limits_write();
@@ -1118,69 +1878,61 @@ void rwx::write(uint32_t offset, const string& buf, uint32_t length)
 		throw user_error("non-aligned writes are not yet supported");
 	}
 
-	string contents;
-	if (false && (capabilities() & cap_read)) {
-		contents = read(offset_w, length_w);
-	}
-
+	metrics::timer t("rwx.write");
 	auto cleaner = make_cleaner();
 	do_init(offset_w, length_w, true);
 	init_progress(offset_w, length_w, true);
 
-	string buf_w;
-
-	if (offset_w != offset) {
-		buf_w += read(offset_w, offset - offset_w);
-	}
-
-	buf_w += buf;
-
-	if (length_w != length) {
-		buf_w += read(offset + buf.size(), length_w - length);
-	}
-
 	throw_if_interrupted();
 
+	auto start = chrono::steady_clock::now();
+	m_stats = stats();
 	unsigned retries = 0;
+	string chunk;
 
 	while (length_w) {
 		uint32_t n = length_w < lim.max ? lim.min : lim.max;
-		auto begin = buf_w.size() - length_w;
-		//string chunk(buf_w.substr(buf_w.size() - length_w, n));
-		string chunk(buf_w.substr(begin, n));
+		next(chunk, n);
+
+		auto chunk_start = chrono::steady_clock::now();
+		unsigned chunk_retries = m_stats.retries;
+		bool ok = false;
+
+		while (!ok && retries < 2) {
+			string what;
+			try {
+				ok = write_chunk(offset_w, chunk);
+			} catch (const exception& e) {
+				what = e.what();
+			}
 
-		if (contents.empty() || contents.substr(begin, n) != chunk) {
-			bool ok = false;
+			throw_if_interrupted();
 
-			while (!ok && retries < 2) {
-				string what;
-				try {
-					ok = write_chunk(offset_w, chunk);
-				} catch (const exception& e) {
-					what = e.what();
+			if (!ok) {
+				string msg = "failed to write chunk 0x" + to_hex(offset_w);
+				if (!what.empty()) {
+					msg += " (" + what + ")";
 				}
 
-				throw_if_interrupted();
-
-				if (!ok) {
-					string msg = "failed to write chunk 0x" + to_hex(offset_w);
-					if (!what.empty()) {
-						msg += " (" + what + ")";
-					}
+				++m_stats.retries;
+				metrics::count("rwx.retries");
 
-					if (++retries < 2 && wait_for_interface(m_intf)) {
-						logger::d() << endl << msg << "; retrying" << endl;
-						//on_chunk_retry(offset_w, chunk.size());
-						continue;
-					}
-
-					 throw runtime_error(msg);
-				} else {
-					retries = 0;
+				if (++retries < 2 && wait_for_interface(m_intf)) {
+					logger::d() << endl << msg << "; retrying" << endl;
+					//on_chunk_retry(offset_w, chunk.size());
+					continue;
 				}
+
+				 throw runtime_error(msg);
+			} else {
+				retries = 0;
 			}
 		}
 
+		chunk_event(offset_w, n, elapsed_millis(chunk_start), m_stats.retries - chunk_retries);
+		metrics::time("rwx.write_chunk", chunk_start);
+		metrics::count("rwx.payload_bytes_written", n);
+
 		if (offset_w < offset) {
 			update_progress(0, 0);
 		} else if (offset_w >= (offset + length)) {
@@ -1192,13 +1944,11 @@ void rwx::write(uint32_t offset, const string& buf, uint32_t length)
 
 		offset_w += n;
 		length_w -= n;
-	}
-}
 
-void rwx::read_special(uint32_t offset, uint32_t length, ostream& os)
-{
-	string buf = read_special(offset, length);
-	os.write(buf.data(), buf.size());
+		m_stats.bytes += n;
+		++m_stats.chunks;
+		m_stats.millis = elapsed_millis(start);
+	}
 }
 
 // TODO this should be migrated to something like
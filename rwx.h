@@ -21,8 +21,10 @@
 #define BCM2DUMP_DUMPER_H
 #include <memory>
 #include <string>
+#include <vector>
 #include "interface.h"
 #include "profile.h"
+#include "sink.h"
 #include "ps.h"
 
 namespace bcm2dump {
@@ -33,11 +35,15 @@ class rwx //: public rwx_writer
 	static unsigned constexpr cap_write = (1 << 1);
 	static unsigned constexpr cap_exec = (1 << 2);
 	static unsigned constexpr cap_special = (1 << 3);
+	// checksum() is calculated on the device
+	static unsigned constexpr cap_checksum = (1 << 4);
 	static unsigned constexpr cap_rw = cap_read | cap_write;
 	static unsigned constexpr cap_rwx = cap_rw | cap_exec;
 
 	typedef std::function<void(uint32_t, uint32_t, bool, bool)> progress_listener;
-	typedef std::function<void(uint32_t, const ps_header&)> image_listener;
+	// offset, length, latency (in milliseconds), retries
+	typedef std::function<void(uint32_t, uint32_t, unsigned, unsigned)> chunk_listener;
+	typedef ps_scanner::listener image_listener;
 	typedef std::shared_ptr<rwx> sp;
 	struct interrupted : public std::exception {};
 
@@ -52,6 +58,22 @@ class rwx //: public rwx_writer
 		const uint32_t max;
 	};
 
+	// pattern match, as returned by search()
+	struct match
+	{
+		uint32_t offset;
+		unsigned pattern;
+	};
+
+	// statistics of the last dump() or write() operation
+	struct stats
+	{
+		uint64_t bytes = 0;
+		unsigned chunks = 0;
+		unsigned retries = 0;
+		unsigned millis = 0;
+	};
+
 	rwx();
 	virtual ~rwx();
 
@@ -63,15 +85,32 @@ class rwx //: public rwx_writer
 
 	void dump(const std::string& spec, std::ostream& os, bool resume = false);
 	void dump(uint32_t offset, uint32_t length, std::ostream& os, bool resume = false);
+	void dump(const std::string& spec, sink& out, bool resume = false);
+	void dump(uint32_t offset, uint32_t length, sink& out, bool resume = false);
 	std::string read(uint32_t offset, uint32_t length);
 
 
 	void write(const std::string& spec, std::istream& is);
+	void write(const std::string& spec, const char* buf, uint32_t size);
 	void write(uint32_t offset, std::istream& is, uint32_t length = 0);
 	void write(uint32_t offset, const std::string& buf, uint32_t length = 0);
+	void write(uint32_t offset, const char* buf, uint32_t length);
 
 	void exec(uint32_t offset);
 
+	// crc32 of each <block_size> bytes in the given range (the
+	// last block may be shorter)
+	std::vector<uint32_t> checksum(const std::string& spec, uint32_t block_size);
+	std::vector<uint32_t> checksum(uint32_t offset, uint32_t length, uint32_t block_size);
+
+	// offsets of all occurences of the given patterns in the given range,
+	// ordered by offset, and pattern index
+	std::vector<match> search(const std::string& spec, const std::vector<std::string>& patterns);
+	std::vector<match> search(uint32_t offset, uint32_t length, const std::vector<std::string>& patterns);
+
+	// resolves a {<partition>[+<offset>],<offset>}[,<size>] argument
+	void parse_spec(const std::string& spec, uint32_t& offset, uint32_t& length, bool write = false);
+
 	//bool imgscan(uint32_t offset, uint32_t length, uint32_t steps, ps_header& hdr);
 
 	static sp create(const interface::sp& interface, const std::string& type, bool safe = true);
@@ -83,6 +122,9 @@ class rwx //: public rwx_writer
 	virtual void set_image_listener(const image_listener& l = image_listener())
 	{ m_img_l = l; }
 
+	virtual void set_chunk_listener(const chunk_listener& l = chunk_listener())
+	{ m_chunk_l = l; }
+
 	virtual void set_partition(const addrspace::part& partition)
 	{ m_partition = partition; }
 
@@ -95,6 +137,9 @@ class rwx //: public rwx_writer
 	virtual const addrspace& space() const
 	{ return m_space; }
 
+	const stats& last_stats() const
+	{ return m_stats; }
+
 	static bool was_interrupted()
 	{ return s_sigint; }
 
@@ -123,10 +168,11 @@ class rwx //: public rwx_writer
 		}
 	}
 
-	void read_special(uint32_t offset, uint32_t length, std::ostream& os);
 	virtual std::string read_special(uint32_t offset, uint32_t length) = 0;
 
-	virtual std::string read_chunk(uint32_t offset, uint32_t length) = 0;
+	// replaces the contents of <chunk>. the same buffer is passed to
+	// each call, so its capacity can be reused.
+	virtual void read_chunk(uint32_t offset, uint32_t length, std::string& chunk) = 0;
 	// chunk length is guaranteed to be either min_length_write() or max_length_write()
 	virtual bool write_chunk(uint32_t offset, const std::string& chunk)
 	{ return false; }
@@ -134,6 +180,11 @@ class rwx //: public rwx_writer
 	virtual bool exec_impl(uint32_t offset)
 	{ return false; }
 
+	// the default implementation reads the whole range; override this
+	// if the checksums can be calculated on the device itself.
+	virtual std::vector<uint32_t> checksum_impl(uint32_t offset, uint32_t length, uint32_t block_size);
+	virtual std::vector<match> search_impl(uint32_t offset, uint32_t length, const std::vector<std::string>& patterns);
+
 	static void throw_if_interrupted()
 	{
 		if (was_interrupted()) {
@@ -153,18 +204,27 @@ class rwx //: public rwx_writer
 		update_progress(offset, length, write, true);
 	}
 
-	virtual void image_detected(uint32_t offset, const ps_header& hdr)
+	virtual void image_event(const ps_scanner::image& img)
 	{
 		if (m_img_l) {
-			m_img_l(offset, hdr);
+			m_img_l(img);
+		}
+	}
+
+	virtual void chunk_event(uint32_t offset, uint32_t length, unsigned millis, unsigned retries)
+	{
+		if (m_chunk_l) {
+			m_chunk_l(offset, length, millis, retries);
 		}
 	}
 
 	interface::sp m_intf;
 	progress_listener m_prog_l;
 	image_listener m_img_l;
+	chunk_listener m_chunk_l;
 	addrspace::part m_partition;
 	addrspace m_space;
+	stats m_stats;
 
 
 	class scoped_cleaner
@@ -186,6 +246,10 @@ class rwx //: public rwx_writer
 	{ return scoped_cleaner(this); }
 
 	private:
+	// replaces the contents of <chunk> with the next <length> bytes
+	typedef std::function<void(std::string& chunk, uint32_t length)> chunk_source;
+	void write_chunks(uint32_t offset, uint32_t length, const chunk_source& next);
+
 	static void handle_sigint(int signal)
 	{ s_sigint = 1; }
 
@@ -0,0 +1,297 @@
+/**
+ * bcm2-utils
+ * Copyright (C) 2016 Joseph Lehner <joseph.c.lehner@gmail.com>
+ *
+ * bcm2-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bcm2-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bcm2-utils.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cstring>
+#include <fstream>
+#include "sink.h"
+#include "util.h"
+using namespace std;
+
+namespace bcm2dump {
+namespace {
+
+class stream_sink : public sink
+{
+	public:
+	stream_sink(ostream& os) : m_os(os)
+	{
+		auto ioex = scoped_ios_exceptions::none(os);
+		m_start = os.tellp();
+		m_pos = 0;
+	}
+
+	virtual uint64_t size() override
+	{
+		if (m_start == -1) {
+			return 0;
+		}
+
+		auto ioex = scoped_ios_exceptions::none(m_os);
+		m_os.seekp(0, ios::end);
+		streampos end = m_os.tellp();
+		m_os.seekp(m_start + streamoff(m_pos));
+
+		if (!m_os.good() || end < m_start) {
+			throw runtime_error("failed to determine length of stream");
+		}
+
+		return end - m_start;
+	}
+
+	virtual void write(uint64_t offset, const char* buf, size_t length) override
+	{
+		auto ioex = scoped_ios_exceptions::failbad(m_os);
+
+		if (offset != m_pos) {
+			if (m_start == -1) {
+				throw runtime_error("cannot seek in stream");
+			}
+
+			m_os.seekp(m_start + streamoff(offset));
+		}
+
+		m_os.write(buf, length);
+		m_pos = offset + length;
+	}
+
+	virtual void finish() override
+	{
+		auto ioex = scoped_ios_exceptions::failbad(m_os);
+		m_os.flush();
+	}
+
+	virtual bool positional() const override
+	{ return m_start != -1; }
+
+	private:
+	ostream& m_os;
+	streampos m_start;
+	uint64_t m_pos;
+};
+
+// a stream sink that owns its file
+class fstream_sink : public stream_sink
+{
+	public:
+	fstream_sink(unique_ptr<ofstream> os) : stream_sink(*os), m_os(move(os)) {}
+
+	private:
+	unique_ptr<ofstream> m_os;
+};
+
+class fd_sink : public sink
+{
+	public:
+	fd_sink(const string& filename, bool resume, int mode = O_WRONLY)
+	: m_filename(filename)
+	{
+		m_fd = open(filename.c_str(), mode | O_CREAT | (resume ? 0 : O_TRUNC), 0644);
+		if (m_fd < 0) {
+			throw errno_error("open: " + filename);
+		}
+
+		struct stat st;
+		if (fstat(m_fd, &st) != 0) {
+			int error = errno;
+			close(m_fd);
+			throw errno_error("fstat: " + filename, error);
+		}
+
+		m_initial = st.st_size;
+	}
+
+	virtual ~fd_sink()
+	{
+		close(m_fd);
+	}
+
+	virtual uint64_t size() override
+	{ return m_initial; }
+
+	virtual void reserve(uint64_t size) override
+	{ m_reserved = size; }
+
+	protected:
+	void extend()
+	{
+		// trailing holes are not part of the file until it's extended
+		if (m_reserved > m_initial && ftruncate(m_fd, m_reserved) != 0) {
+			throw errno_error("ftruncate: " + m_filename);
+		}
+	}
+
+	string m_filename;
+	int m_fd;
+	uint64_t m_initial;
+	uint64_t m_reserved = 0;
+};
+
+class pwrite_sink : public fd_sink
+{
+	public:
+	pwrite_sink(const string& filename, bool resume) : fd_sink(filename, resume) {}
+
+	virtual void write(uint64_t offset, const char* buf, size_t length) override
+	{
+		foreach_extent(offset, buf, length, m_initial, [this] (uint64_t offset, const char* buf, size_t length) {
+			while (length) {
+				ssize_t n = pwrite(m_fd, buf, length, offset);
+				if (n < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					throw errno_error("pwrite: " + m_filename);
+				}
+
+				offset += n;
+				buf += n;
+				length -= n;
+			}
+		});
+	}
+
+	virtual void finish() override
+	{
+		extend();
+	}
+};
+
+class mmap_sink : public fd_sink
+{
+	public:
+	mmap_sink(const string& filename, bool resume) : fd_sink(filename, resume, O_RDWR) {}
+
+	virtual ~mmap_sink()
+	{
+		if (m_data) {
+			munmap(m_data, m_size);
+		}
+	}
+
+	virtual void reserve(uint64_t size) override
+	{
+		fd_sink::reserve(size);
+		m_size = max(size, m_initial);
+
+		if (!m_size) {
+			return;
+		}
+
+		// allocate all blocks now, so that a full disk is reported here,
+		// and not as a SIGBUS in write()
+		if (!sparse() && m_size > m_initial) {
+			int error = posix_fallocate(m_fd, 0, m_size);
+			if (error) {
+				throw errno_error("posix_fallocate: " + m_filename, error);
+			}
+		} else {
+			extend();
+		}
+
+		void* data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+		if (data == MAP_FAILED) {
+			throw errno_error("mmap: " + m_filename);
+		}
+
+		m_data = reinterpret_cast<char*>(data);
+	}
+
+	virtual void write(uint64_t offset, const char* buf, size_t length) override
+	{
+		if (!m_data || (offset + length) > m_size) {
+			throw runtime_error("write beyond end of mapping: " + m_filename);
+		}
+
+		foreach_extent(offset, buf, length, m_initial, [this] (uint64_t offset, const char* buf, size_t length) {
+			memcpy(m_data + offset, buf, length);
+		});
+	}
+
+	virtual void finish() override
+	{
+		if (m_data && msync(m_data, m_size, MS_SYNC) != 0) {
+			throw errno_error("msync: " + m_filename);
+		}
+	}
+
+	private:
+	char* m_data = nullptr;
+	uint64_t m_size = 0;
+};
+}
+
+constexpr size_t sink::hole_size;
+
+bool sink::is_hole(uint64_t offset, const char* buf, size_t length, uint64_t holes_from)
+{
+	// existing data must be overwritten, even if it's all zeroes
+	if (offset < holes_from) {
+		return false;
+	}
+
+	static const char zeroes[hole_size] = { 0 };
+	return !memcmp(buf, zeroes, length);
+}
+
+sink::sp sink::create(ostream& os)
+{
+	return make_shared<stream_sink>(os);
+}
+
+sink::sp sink::create(const string& type, const string& filename, bool resume)
+{
+	auto tokens = split(type, ',');
+	if (tokens.empty() || tokens.size() > 2 || (tokens.size() == 2 && tokens[1] != "sparse")) {
+		throw user_error("invalid output type '" + type + "'");
+	} else if (tokens.size() == 2 && tokens[0] == "stream") {
+		// stream sinks can't skip data
+		throw user_error("invalid output type '" + type + "'; sparse is not supported with streams");
+	}
+
+	sp ret;
+
+	if (tokens[0] == "stream") {
+		ios::openmode mode = ios::out | ios::binary;
+		if (resume) {
+			// without ios::in, the file will be overwritten!
+			mode |= ios::in;
+		}
+
+		unique_ptr<ofstream> os(new ofstream(filename, mode));
+		if (!os->good()) {
+			throw user_error("failed to open " + filename + " for writing");
+		}
+
+		ret = make_shared<fstream_sink>(move(os));
+	} else if (tokens[0] == "file") {
+		ret = make_shared<pwrite_sink>(filename, resume);
+	} else if (tokens[0] == "mmap") {
+		ret = make_shared<mmap_sink>(filename, resume);
+	} else {
+		throw user_error("invalid output type '" + type + "'");
+	}
+
+	ret->set_sparse(tokens.size() == 2);
+	return ret;
+}
+}
@@ -0,0 +1,112 @@
+/**
+ * bcm2-utils
+ * Copyright (C) 2016 Joseph Lehner <joseph.c.lehner@gmail.com>
+ *
+ * bcm2-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bcm2-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bcm2-utils.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef BCM2DUMP_SINK_H
+#define BCM2DUMP_SINK_H
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+
+namespace bcm2dump {
+
+// destination of a dump. offsets are relative to the start of the
+// output, which, for streams, is the position at the time the sink
+// was created.
+class sink
+{
+	public:
+	typedef std::shared_ptr<sink> sp;
+
+	// block size used for detecting holes
+	static constexpr size_t hole_size = 4096;
+
+	virtual ~sink() {}
+
+	// size of the existing data, used to resume a dump
+	virtual uint64_t size() = 0;
+	// called before the first write(), with the final size of the output
+	virtual void reserve(uint64_t size) {}
+	// if positional() is false, offsets must be consecutive
+	virtual void write(uint64_t offset, const char* buf, size_t length) = 0;
+	// flushes all data. must be called once the dump is complete.
+	virtual void finish() {}
+
+	virtual bool positional() const
+	{ return true; }
+
+	// skip blocks of zeroes beyond the end of the existing data,
+	// leaving holes in sparse files. ignored by stream sinks.
+	void set_sparse(bool sparse)
+	{ m_sparse = sparse; }
+
+	bool sparse() const
+	{ return m_sparse; }
+
+	static sp create(std::ostream& os);
+	// <type> is one of "stream", "file" (using pwrite), or "mmap". the
+	// latter two may be followed by ",sparse". existing files are
+	// truncated, unless <resume> is true.
+	static sp create(const std::string& type, const std::string& filename, bool resume);
+
+	protected:
+	// calls f(offset, buf, length) for each part of the given buffer
+	// that is not a hole
+	template<class F> void foreach_extent(uint64_t offset, const char* buf, size_t length,
+			uint64_t holes_from, F f)
+	{
+		if (!m_sparse) {
+			f(offset, buf, length);
+			return;
+		}
+
+		while (length) {
+			// split at hole_size boundaries of the output
+			size_t n = std::min<uint64_t>(length, hole_size - (offset % hole_size));
+			size_t k = n;
+
+			// merge consecutive blocks of the same kind
+			bool hole = is_hole(offset, buf, n, holes_from);
+			while (k < length) {
+				size_t m = std::min<size_t>(length - k, hole_size);
+				if (is_hole(offset + k, buf + k, m, holes_from) != hole) {
+					break;
+				}
+				k += m;
+			}
+
+			if (!hole) {
+				f(offset, buf, k);
+			}
+
+			offset += k;
+			buf += k;
+			length -= k;
+		}
+	}
+
+	private:
+	static bool is_hole(uint64_t offset, const char* buf, size_t length, uint64_t holes_from);
+
+	bool m_sparse = false;
+};
+}
+
+#endif
@@ -0,0 +1,261 @@
+/**
+ * bcm2-utils
+ * Copyright (C) 2016 Joseph Lehner <joseph.c.lehner@gmail.com>
+ *
+ * bcm2-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bcm2-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bcm2-utils.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <openssl/evp.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <cstdio>
+#include "store.h"
+#include "util.h"
+using namespace std;
+
+namespace bcm2dump {
+namespace {
+
+void make_dir(const string& dir)
+{
+	if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+		throw errno_error("mkdir: " + dir);
+	}
+}
+
+// writes to a temporary file first, so that an interrupted
+// write doesn't leave a truncated file behind.
+void write_file(const string& filename, const string& data)
+{
+	string tmp = filename + ".tmp" + to_string(getpid());
+
+	{
+		ofstream out(tmp, ios::binary | ios::trunc);
+		out.write(data.data(), data.size());
+		out.close();
+
+		if (!out) {
+			unlink(tmp.c_str());
+			throw user_error("failed to write " + tmp);
+		}
+	}
+
+	if (rename(tmp.c_str(), filename.c_str()) != 0) {
+		int error = errno;
+		unlink(tmp.c_str());
+		throw errno_error("rename: " + tmp, error);
+	}
+}
+
+inline uint64_t index_key(uint32_t crc, uint32_t size)
+{
+	return (uint64_t(crc) << 32) | size;
+}
+}
+
+block_store::block_store(const string& dir)
+: m_dir(dir)
+{
+	make_dir(m_dir);
+	make_dir(m_dir + "/blocks");
+	make_dir(m_dir + "/manifests");
+
+	DIR* d = opendir((m_dir + "/manifests").c_str());
+	if (!d) {
+		throw errno_error("opendir: " + m_dir + "/manifests");
+	}
+
+	vector<string> names;
+
+	while (struct dirent* e = readdir(d)) {
+		string name = e->d_name;
+		if (name[0] != '.' && name.find(".tmp") == string::npos) {
+			names.push_back(name);
+		}
+	}
+
+	closedir(d);
+
+	for (auto& name : names) {
+		index(read_manifest(name));
+	}
+}
+
+string block_store::lookup(uint32_t crc, uint32_t size) const
+{
+	auto it = m_index.find(index_key(crc, size));
+	return it != m_index.end() ? it->second : "";
+}
+
+bool block_store::contains(const string& hash) const
+{
+	return access(block_path(hash).c_str(), F_OK) == 0;
+}
+
+string block_store::put(const char* buf, size_t size)
+{
+	string hash = sha256(buf, size);
+
+	if (!contains(hash)) {
+		make_dir(m_dir + "/blocks/" + hash.substr(0, 2));
+		write_file(block_path(hash), string(buf, size));
+	}
+
+	return hash;
+}
+
+string block_store::get(const string& hash) const
+{
+	string filename = block_path(hash);
+	ifstream in(filename, ios::binary);
+	if (!in.good()) {
+		throw user_error("missing block " + hash);
+	}
+
+	string buf((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+	if (sha256(buf.data(), buf.size()) != hash) {
+		throw runtime_error("corrupted block " + hash);
+	}
+
+	return buf;
+}
+
+void block_store::write_manifest(const string& name, const string& comment, const manifest& blocks)
+{
+	ostringstream ostr;
+	ostr << "# " << comment << endl;
+	ostr << "# offset size crc32 sha256" << endl;
+
+	for (auto& b : blocks) {
+		ostr << "0x" << to_hex(b.offset) << " " << b.size << " 0x" << to_hex(b.crc) << " " << b.hash << endl;
+	}
+
+	write_file(m_dir + "/manifests/" + name, ostr.str());
+	index(blocks);
+}
+
+block_store::manifest block_store::read_manifest(const string& name) const
+{
+	string filename = m_dir + "/manifests/" + name;
+	ifstream in(filename);
+	if (!in.good()) {
+		throw user_error("no such manifest: " + filename);
+	}
+
+	manifest ret;
+	string line;
+
+	while (getline(in, line)) {
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+
+		auto tokens = split(line, ' ');
+		if (tokens.size() != 4 || tokens[3].size() != 64) {
+			throw runtime_error("invalid line in " + filename + ": " + line);
+		}
+
+		block b;
+		b.offset = lexical_cast<uint32_t>(tokens[0], 0);
+		b.size = lexical_cast<uint32_t>(tokens[1]);
+		b.crc = lexical_cast<uint32_t>(tokens[2], 0);
+		b.hash = tokens[3];
+		ret.push_back(b);
+	}
+
+	return ret;
+}
+
+string block_store::sha256(const char* buf, size_t size)
+{
+	unsigned char md[EVP_MAX_MD_SIZE];
+	unsigned len = 0;
+
+	if (!EVP_Digest(buf, size, md, &len, EVP_sha256(), nullptr)) {
+		throw runtime_error("failed to calculate sha256");
+	}
+
+	return to_hex(string(reinterpret_cast<char*>(md), len));
+}
+
+string block_store::block_path(const string& hash) const
+{
+	return m_dir + "/blocks/" + hash.substr(0, 2) + "/" + hash;
+}
+
+void block_store::index(const manifest& blocks)
+{
+	for (auto& b : blocks) {
+		auto it = m_index.find(index_key(b.crc, b.size));
+		if (it == m_index.end()) {
+			m_index[index_key(b.crc, b.size)] = b.hash;
+		} else if (it->second != b.hash) {
+			// crc32 collision, so this crc can't be used to identify a block
+			it->second.clear();
+		}
+	}
+}
+
+void store_sink::write(uint64_t offset, const char* buf, size_t length)
+{
+	offset += m_origin;
+
+	if (offset != m_pos + m_buf.size()) {
+		throw runtime_error("non-sequential write to block store");
+	}
+
+	while (length) {
+		size_t n = min<size_t>(length, m_block_size - m_buf.size());
+		m_buf.append(buf, n);
+		buf += n;
+		length -= n;
+
+		if (m_buf.size() == m_block_size) {
+			store_block();
+		}
+	}
+}
+
+void store_sink::finish()
+{
+	if (!m_buf.empty()) {
+		store_block();
+	}
+}
+
+void store_sink::set_origin(uint64_t origin)
+{
+	if (!m_buf.empty() || (origin % m_block_size)) {
+		throw invalid_argument("invalid origin " + to_string(origin));
+	}
+
+	m_origin = m_pos = origin;
+}
+
+void store_sink::store_block()
+{
+	block_store::block b;
+	b.offset = m_offset + m_pos;
+	b.size = m_buf.size();
+	b.crc = crc32_ieee(m_buf);
+	b.hash = m_store.put(m_buf.data(), m_buf.size());
+	m_blocks.push_back(b);
+
+	m_pos += m_buf.size();
+	m_buf.clear();
+}
+}
@@ -0,0 +1,110 @@
+/**
+ * bcm2-utils
+ * Copyright (C) 2016 Joseph Lehner <joseph.c.lehner@gmail.com>
+ *
+ * bcm2-utils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bcm2-utils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bcm2-utils.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef BCM2DUMP_STORE_H
+#define BCM2DUMP_STORE_H
+#include <unordered_map>
+#include <string>
+#include <vector>
+#include "sink.h"
+
+namespace bcm2dump {
+
+// a content-addressed block store. each dump is split into blocks of
+// a fixed size, which are stored once, using their SHA-256 as the file
+// name (<dir>/blocks/<xx>/<hash>). the list of blocks that make up a
+// dump is stored in <dir>/manifests/<name>.
+class block_store
+{
+	public:
+	struct block
+	{
+		// offset in the dumped address space
+		uint32_t offset;
+		uint32_t size;
+		uint32_t crc;
+		std::string hash;
+	};
+
+	typedef std::vector<block> manifest;
+
+	block_store(const std::string& dir);
+
+	// hash of a stored block with the given crc32 and size. returns an
+	// empty string if there is no such block, or if it's ambiguous.
+	std::string lookup(uint32_t crc, uint32_t size) const;
+
+	bool contains(const std::string& hash) const;
+	// stores the block (unless it's already present), and returns its hash
+	std::string put(const char* buf, size_t size);
+	// reads a block, and verifies its hash
+	std::string get(const std::string& hash) const;
+
+	void write_manifest(const std::string& name, const std::string& comment, const manifest& blocks);
+	manifest read_manifest(const std::string& name) const;
+
+	static std::string sha256(const char* buf, size_t size);
+
+	private:
+	std::string block_path(const std::string& hash) const;
+	void index(const manifest& blocks);
+
+	std::string m_dir;
+	// hashes by (crc32 << 32 | size). ambiguous entries are empty.
+	std::unordered_map<uint64_t, std::string> m_index;
+};
+
+// a sink that splits its input into blocks, and stores them. writes
+// must be sequential; use set_origin() to skip blocks.
+class store_sink : public sink
+{
+	public:
+	store_sink(block_store& store, uint32_t offset, uint32_t block_size)
+	: m_store(store), m_offset(offset), m_block_size(block_size) {}
+
+	virtual uint64_t size() override
+	{ return 0; }
+
+	virtual void write(uint64_t offset, const char* buf, size_t length) override;
+	// stores the last (possibly incomplete) block
+	virtual void finish() override;
+
+	virtual bool positional() const override
+	{ return false; }
+
+	// subsequent writes start at <origin> (must be a multiple of the block size)
+	void set_origin(uint64_t origin);
+
+	const block_store::manifest& blocks() const
+	{ return m_blocks; }
+
+	private:
+	void store_block();
+
+	block_store& m_store;
+	uint32_t m_offset;
+	uint32_t m_block_size;
+	uint64_t m_origin = 0;
+	uint64_t m_pos = 0;
+	std::string m_buf;
+	block_store::manifest m_blocks;
+};
+}
+
+#endif
@@ -17,7 +17,11 @@
  *
  */
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <netdb.h>
+#include <fcntl.h>
 #include "profile.h"
 #include "util.h"
 using namespace std;
@@ -128,25 +132,6 @@ string to_hex(const std::string& buffer)
 	return ret;
 }
 
-uint16_t crc16_ccitt(const void* buf, size_t size)
-{
-	uint32_t crc = 0xffff;
-	uint32_t poly = 0x1021;
-
-	for (size_t i = 0; i < size; ++i) {
-		for (size_t k = 0; k < 8; ++k) {
-			bool bit = (reinterpret_cast<const char*>(buf)[i] >> (7 - k) & 1);
-			bool c15 = (crc >> 15 & 1);
-			crc <<= 1;
-			if (c15 ^ bit) {
-				crc ^= poly;
-			}
-		}
-	}
-
-	return crc & 0xffff;
-}
-
 std::string transform(const std::string& str, std::function<int(int)> f)
 {
 	string ret;
@@ -180,6 +165,98 @@ ostream& logger::log(int severity)
 	}
 }
 
+mapped_file::mapped_file(const string& filename)
+{
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw errno_error("open: " + filename);
+	}
+
+	struct stat st;
+	int error = 0;
+
+	if (fstat(fd, &st) != 0) {
+		error = errno;
+	} else if (!S_ISREG(st.st_mode) || !st.st_size) {
+		error = ENODEV;
+	}
+
+	if (error) {
+		close(fd);
+		throw errno_error("mmap: " + filename, error);
+	}
+
+	void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	error = errno;
+	close(fd);
+
+	if (data == MAP_FAILED) {
+		throw errno_error("mmap: " + filename, error);
+	}
+
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+	m_data = reinterpret_cast<const char*>(data);
+	m_size = st.st_size;
+}
+
+mapped_file::~mapped_file()
+{
+	munmap(const_cast<char*>(m_data), m_size);
+}
+
+imemstream::imemstream(const char* data, size_t size)
+: istream(nullptr), m_buf(data, size)
+{
+	rdbuf(&m_buf);
+}
+
+const char* imemstream::take(size_t size)
+{
+	if (size > m_buf.remaining()) {
+		setstate(ios::failbit);
+		return nullptr;
+	}
+
+	const char* ret = m_buf.cur();
+	m_buf.skip(size);
+	return ret;
+}
+
+imemstream::membuf::membuf(const char* data, size_t size)
+{
+	// streambuf's interface isn't const-correct, but the get area is never written to
+	char* p = const_cast<char*>(data);
+	setg(p, p, p + size);
+}
+
+imemstream::membuf::pos_type imemstream::membuf::seekoff(off_type off, ios::seekdir dir, ios::openmode which)
+{
+	if (which & ios::out) {
+		return pos_type(off_type(-1));
+	}
+
+	off_type base;
+	if (dir == ios::beg) {
+		base = 0;
+	} else if (dir == ios::cur) {
+		base = gptr() - eback();
+	} else {
+		base = egptr() - eback();
+	}
+
+	if ((base + off) < 0 || (base + off) > (egptr() - eback())) {
+		return pos_type(off_type(-1));
+	}
+
+	setg(eback(), eback() + base + off, egptr());
+	return pos_type(base + off);
+}
+
+imemstream::membuf::pos_type imemstream::membuf::seekpos(pos_type pos, ios::openmode which)
+{
+	return seekoff(off_type(pos), ios::beg, which);
+}
+
 string getaddrinfo_category::message(int condition) const
 {
 	return gai_strerror(condition);
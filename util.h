@@ -26,6 +26,7 @@
 #include <functional>
 #include <stdexcept>
 #include <typeinfo>
+#include <chrono>
 #include <iostream>
 #include <iomanip>
 #include <netdb.h>
@@ -36,6 +37,7 @@
 #include <vector>
 #include <string>
 #include <ios>
+#include "crc.h"
 
 namespace bcm2dump {
 
@@ -70,7 +72,8 @@ class bad_lexical_cast : public std::invalid_argument
 
 template<class T> T lexical_cast(const std::string& str, unsigned base = 10)
 {
-	static std::istringstream istr;
+	// thread_local, because this may be used while decoding groups in parallel
+	thread_local std::istringstream istr;
 	istr.clear();
 	istr.str(str);
 	T t;
@@ -84,20 +87,24 @@ template<class T> T lexical_cast(const std::string& str, unsigned base = 10)
 	}
 
 	if ((istr >> std::setbase(base) >> t)) {
-		if (!istr.eof() && base == 10) {
-			switch (istr.get()) {
+		int c = istr.get();
+
+		if (base == 10) {
+			switch (c) {
 			case 'k':
 			case 'K':
 				t *= 1024;
+				c = istr.get();
 				break;
 			case 'm':
 			case 'M':
 				t *= 1024 * 1024;
+				c = istr.get();
 				break;
 			}
 		}
 
-		if (istr.eof() || istr.get() == '\0') {
+		if (c == std::char_traits<char>::eof() || c == '\0') {
 			return t;
 		}
 	}
@@ -137,13 +144,10 @@ template<class T> T align_right(const T& nv_num, size_t alignment)
 	return nv_num + (rem ? alignment - rem : 0);
 }
 
-uint16_t crc16_ccitt(const void* buf, size_t size);
-inline uint16_t crc16_ccitt(const std::string& buf)
-{ return crc16_ccitt(buf.data(), buf.size()); }
-
-inline unsigned elapsed_millis(std::clock_t start, std::clock_t now = std::clock())
+inline unsigned elapsed_millis(std::chrono::steady_clock::time_point start,
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now())
 {
-	return 1000 * (now - start) / CLOCKS_PER_SEC;
+	return std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count();
 }
 
 std::string transform(const std::string& str, std::function<int(int)> f);
@@ -280,6 +284,21 @@ class logger
 	static int s_loglevel;
 };
 
+// like logger::log(), but the arguments are only evaluated if the level is
+// enabled, which makes them (almost) free on hot paths:
+//
+// BCM2UTILS_LOG(debug) << "value is " << v.val->to_pretty() << std::endl;
+//
+// the dangling else is intentional; it makes the macro safe to use in
+// unbraced if/else statements.
+#define BCM2UTILS_LOG(level) \
+	if (::bcm2dump::logger::loglevel() > ::bcm2dump::logger::level) {} \
+	else ::bcm2dump::logger::log(::bcm2dump::logger::level)
+
+#define LOG_T BCM2UTILS_LOG(trace)
+#define LOG_D BCM2UTILS_LOG(debug)
+#define LOG_V BCM2UTILS_LOG(verbose)
+
 class user_error : public std::runtime_error
 {
 	public:
@@ -302,6 +321,82 @@ class errno_error : public std::system_error
 	bool m_interrupted;
 };
 
+// read-only memory mapping of a regular file. throws errno_error if
+// the file cannot be mapped (e.g. because it's a pipe, or empty).
+class mapped_file
+{
+	public:
+	mapped_file(const std::string& filename);
+	~mapped_file();
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	const char* data() const
+	{ return m_data; }
+
+	size_t size() const
+	{ return m_size; }
+
+	private:
+	const char* m_data = nullptr;
+	size_t m_size = 0;
+};
+
+// an input stream that reads directly from a memory buffer (such as a
+// mapped_file), without copying it, unlike std::istringstream. the buffer
+// must outlive the stream.
+//
+// this saves copying whole files (see read_stream()); the values
+// themselves are still read using istream::read().
+class imemstream : public std::istream
+{
+	public:
+	imemstream(const char* data, size_t size);
+	explicit imemstream(const std::string& buf)
+	: imemstream(buf.data(), buf.size()) {}
+
+	imemstream(const imemstream&) = delete;
+	imemstream& operator=(const imemstream&) = delete;
+
+	// the unread part of the buffer
+	const char* cur() const
+	{ return m_buf.cur(); }
+
+	size_t remaining() const
+	{ return m_buf.remaining(); }
+
+	// consumes <size> bytes, and returns a pointer to them. if fewer bytes
+	// are remaining, nothing is consumed, failbit is set, and nullptr is
+	// returned.
+	const char* take(size_t size);
+
+	private:
+	class membuf : public std::streambuf
+	{
+		public:
+		membuf(const char* data, size_t size);
+
+		const char* cur() const
+		{ return gptr(); }
+
+		size_t remaining() const
+		{ return egptr() - gptr(); }
+
+		void skip(size_t size)
+		{ gbump(size); }
+
+		protected:
+		virtual pos_type seekoff(off_type off, std::ios::seekdir dir, std::ios::openmode which) override;
+		virtual pos_type seekpos(pos_type pos, std::ios::openmode which) override;
+		// only called once the buffer is exhausted
+		virtual std::streamsize showmanyc() override
+		{ return -1; }
+	};
+
+	membuf m_buf;
+};
+
 class getaddrinfo_category : public std::error_category
 {
 	virtual const char* name() const noexcept override